@@ -26,7 +26,8 @@
 
 #include <OctoWS2811.h>
 
-// The actual arrangement of the LEDs connected to this Teensy 3.0 board.
+// The actual arrangement of the LEDs connected to this Teensy 3.x board (see
+// the RAM note by FRAME_BYTES for what fits on a Teensy 3.0).
 // LED_HEIGHT *must* be a multiple of 8.  When 16, 24, 32 are used, each
 // strip spans 2, 3, 4 rows.  LED_LAYOUT indicates the direction the strips
 // are arranged.  If 0, each strip begins on the left for its first row,
@@ -35,6 +36,8 @@
 #define LED_WIDTH      240   // number of LEDs horizontally
 #define LED_HEIGHT     8   // number of LEDs vertically (must be multiple of 8)
 #define LED_LAYOUT     0    // 0 = even rows left->right, 1 = even rows right->left
+#define LED_RGBW       0    // 1 for RGBW strips, must match an RGBW "color-order" on the host
+#define GREEN_CHANNEL  0    // Position of green in the host's "color-order": 0 for GRB, 1 for RGB or BGR, 2 for RBG or BRG
 
 // The portion of the video image to show on this set of LEDs.  All 4 numbers
 // are percentages, from 0 to 100.  For a large LED installation with many
@@ -50,36 +53,356 @@
 
 const int ledsPerStrip = LED_WIDTH * LED_HEIGHT / 8;
 
-DMAMEM int displayMemory[ledsPerStrip*6];
-int drawingMemory[ledsPerStrip*6];
+// Serial framing, must match the "protocol" setting for this output on the host.
+// 1 = '*' followed by the raw frame
+// 2 = magic, type, length, frame counter, payload, CRC-32C (see src/protocol.h)
+#define PROTOCOL_VERSION 1
+
+#define MAGIC_SIZE     4
+#define HEADER_SIZE    16
+#define TRAILER_SIZE   4
+#define PUSHBACK_SIZE  32
+#define TYPE_FULL      'F'
+#define TYPE_PARTIAL   'P'
+#define FLAG_RLE       0x01
+#define FORMATS        3
+#define CHANNELS       (LED_RGBW ? 4 : 3)
+#define COLUMN_SIZE    (CHANNELS * 8)
+#define REPLY_ACK      'A'
+#define REPLY_REJECT   'N'
+
+// Protocol 2 keeps a receive buffer next to OctoWS2811's two frame buffers,
+// each LED_WIDTH * LED_HEIGHT * CHANNELS bytes.  A Teensy 3.0 (MK20DX128) has
+// 16 KB of RAM, which leaves room for only small layouts once the USB serial
+// buffers and stack are counted; larger ones need a Teensy 3.1 or later.
+#define FRAME_BYTES    (LED_WIDTH * LED_HEIGHT * CHANNELS)
+#if defined(__MK20DX128__) && PROTOCOL_VERSION == 2 && (3 * FRAME_BYTES > 12 * 1024)
+#error "This layout needs more RAM than a Teensy 3.0 has with protocol 2: use a Teensy 3.1 or later, or fewer LEDs"
+#endif
+
+DMAMEM int displayMemory[ledsPerStrip*CHANNELS*2];
+int drawingMemory[ledsPerStrip*CHANNELS*2];
 elapsedMicros elapsedUsecSinceLastFrameSync = 0;
 
-const int config = WS2811_GRB | WS2811_800kHz; // color config is on the PC side
+const int config = (LED_RGBW ? WS2811_GRBW : WS2811_GRB) | WS2811_800kHz; // color config is on the PC side
 
 OctoWS2811 leds(ledsPerStrip, displayMemory, drawingMemory, config);
 
+const uint8_t magic[MAGIC_SIZE] = {'F', 'N', 'v', '2'};
+uint32_t crcTable[256];
+
+// Bytes we already pulled off the wire that turned out to start the next frame
+uint8_t pushback[PUSHBACK_SIZE];
+int pushbackLen = 0;
+int pushbackPos = 0;
+
+// Frames are checked here before they touch drawingMemory, so a bad frame
+// never leaves garbage behind for the next partial update to build on.
+//
+// Frames sent with "compress" are read into the end of it and expanded in
+// place from its start once their CRC checks out.  The expanded bytes stay
+// behind the unread ones as long as there is one spare byte per 128 literal
+// bytes, plus one, since only literal control bytes expand to less.
+#define DECODE_SLACK   (sizeof(drawingMemory) / 128 + 2)
+uint8_t receiveBuffer[sizeof(drawingMemory) + DECODE_SLACK];
+
+// Bit planes per channel (wire order, then white) for each frame format, see
+// src/bit_depth.h.  565 gives its 6 planes to green, wherever the color order puts it.
+const uint8_t formatPlanes[FORMATS][4] = {
+  {8, 8, 8, 8},
+  {GREEN_CHANNEL == 0 ? 6 : 5, GREEN_CHANNEL == 1 ? 6 : 5, GREEN_CHANNEL == 2 ? 6 : 5, 6},
+  {4, 4, 4, 4}
+};
+
+int magicMatched = 0;
+uint32_t currentFrameId = 0;
+bool haveFrame = false;
+
+void initCrc() {
+  for (uint32_t i = 0; i < 256; i++) {
+    uint32_t crc = i;
+    for (int bit = 0; bit < 8; bit++) {
+      crc = (crc >> 1) ^ ((crc & 1) ? 0x82F63B78 : 0);
+    }
+    crcTable[i] = crc;
+  }
+}
+
+uint32_t updateCrc(uint32_t crc, const uint8_t *data, uint32_t len) {
+  for (uint32_t i = 0; i < len; i++) {
+    crc = crcTable[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+  }
+  return crc;
+}
+
+uint32_t readLE32(const uint8_t *p) {
+  return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+void reply(uint8_t kind, uint32_t frameId) {
+  uint8_t msg[5] = {kind, (uint8_t)frameId, (uint8_t)(frameId >> 8), (uint8_t)(frameId >> 16), (uint8_t)(frameId >> 24)};
+  Serial.write(msg, sizeof(msg));
+  Serial.send_now();
+}
+
+uint32_t columnBytes(const uint8_t *planes) {
+  uint32_t size = 0;
+  for (int channel = 0; channel < CHANNELS; channel++) {
+    size += planes[channel];
+  }
+  return size;
+}
+
+// Rebuilds the full bit planes of one pixel column from a packed one.  The
+// dropped low planes repeat the top ones, so full scale stays 255.
+void expandColumn(const uint8_t *in, uint8_t *out, const uint8_t *planes) {
+  for (int channel = 0; channel < CHANNELS; channel++) {
+    for (int plane = 0; plane < 8; plane++) {
+      out[plane] = in[plane % planes[channel]];
+    }
+    in += planes[channel];
+    out += 8;
+  }
+}
+
+// Copies packed columns into drawingMemory, expanding them if needed.
+void copyColumns(uint32_t offset, const uint8_t *data, uint32_t length, uint8_t format) {
+  uint8_t *frame = (uint8_t *)drawingMemory;
+  if (format == 0) {
+    memcpy(frame + offset, data, length);
+    return;
+  }
+
+  const uint8_t *planes = formatPlanes[format];
+  uint32_t columnSize = columnBytes(planes);
+  for (uint32_t pos = 0; pos < length; pos += columnSize) {
+    expandColumn(data + pos, frame + (offset + pos) / columnSize * COLUMN_SIZE, planes);
+  }
+}
+
+// Copies the changed ranges of a partial frame into drawingMemory.  Must match
+// apply_partial() in src/partial.cpp.  Offsets are in the packed layout of format.
+bool applyPartial(const uint8_t *payload, uint32_t len, uint8_t format) {
+  const uint8_t *planes = formatPlanes[format];
+  uint32_t columnSize = columnBytes(planes);
+  uint32_t frameSize = ledsPerStrip * columnSize;
+  uint32_t count = readLE32(payload + 4);
+
+  uint32_t pos = 8;
+  for (uint32_t i = 0; i < count; i++) {
+    if (len - pos < 8) {
+      return false;
+    }
+    uint32_t offset = readLE32(payload + pos);
+    uint32_t length = readLE32(payload + pos + 4);
+    pos += 8;
+    if (offset > frameSize || length > frameSize - offset || length > len - pos) {
+      return false;
+    }
+    if (offset % columnSize != 0 || length % columnSize != 0) {
+      return false;
+    }
+    pos += length;
+  }
+
+  pos = 8;
+  for (uint32_t i = 0; i < count; i++) {
+    uint32_t offset = readLE32(payload + pos);
+    uint32_t length = readLE32(payload + pos + 4);
+    copyColumns(offset, payload + pos + 8, length, format);
+    pos += 8 + length;
+  }
+
+  return true;
+}
+
+// Expands a run-length encoded payload.  Must match rle_decode() in src/rle.cpp.
+// Returns the decoded length, or 0 if it is malformed or does not fit.  out
+// may start before in within the same buffer.
+uint32_t rleDecode(const uint8_t *in, uint32_t len, uint8_t *out, uint32_t capacity) {
+  uint32_t pos = 0;
+  uint32_t count = 0;
+
+  while (pos < len) {
+    uint8_t control = in[pos++];
+    if (control < 128) {
+      uint32_t literal = control + 1;
+      if (literal > len - pos || literal > capacity - count) {
+        return 0;
+      }
+      memmove(out + count, in + pos, literal);
+      pos += literal;
+      count += literal;
+    } else {
+      uint32_t run = control - 128 + 3;
+      if (pos == len || run > capacity - count) {
+        return 0;
+      }
+      memset(out + count, in[pos++], run);
+      count += run;
+    }
+  }
+
+  return count;
+}
+
+int nextByte() {
+  if (pushbackPos < pushbackLen) {
+    return pushback[pushbackPos++];
+  }
+  return Serial.read();
+}
+
+uint32_t readInto(uint8_t *dst, uint32_t len) {
+  uint32_t count = 0;
+  while (count < len && pushbackPos < pushbackLen) {
+    dst[count++] = pushback[pushbackPos++];
+  }
+  if (count < len) {
+    count += Serial.readBytes((char *)dst + count, len - count);
+  }
+  return count;
+}
+
+// After a bad CRC the frame we read probably ran into the next one.  Find where
+// the next magic starts in the tail we just read and feed it back to the scanner.
+void resync(const uint8_t *payload, uint32_t len, const uint8_t *trailer) {
+  uint8_t tail[PUSHBACK_SIZE];
+  const int fromPayload = (len < PUSHBACK_SIZE - TRAILER_SIZE) ? len : PUSHBACK_SIZE - TRAILER_SIZE;
+  const int tailLen = fromPayload + TRAILER_SIZE;
+  memcpy(tail, payload + len - fromPayload, fromPayload);
+  memcpy(tail + fromPayload, trailer, TRAILER_SIZE);
+
+  for (int start = 0; start < tailLen; start++) {
+    int j = 0;
+    while (j < MAGIC_SIZE && start + j < tailLen && tail[start + j] == magic[j]) {
+      j++;
+    }
+    if (j == MAGIC_SIZE || start + j == tailLen) {
+      pushbackLen = tailLen - start;
+      pushbackPos = 0;
+      memcpy(pushback, tail + start, pushbackLen);
+      return;
+    }
+  }
+}
+
+void showFrame() {
+  digitalWrite(12, HIGH);
+  pinMode(12, OUTPUT);
+  //delayMicroseconds(usToWaitBeforeSyncOutput);
+  digitalWrite(12, LOW);
+  // WS2811 update begins immediately after falling edge of frame sync
+  digitalWrite(13, HIGH);
+  leds.show();
+  digitalWrite(13, LOW);
+}
+
+void receiveFrame() {
+  uint8_t header[HEADER_SIZE];
+  uint8_t trailer[TRAILER_SIZE];
+
+  memcpy(header, magic, MAGIC_SIZE);
+  if (readInto(header + MAGIC_SIZE, HEADER_SIZE - MAGIC_SIZE) != HEADER_SIZE - MAGIC_SIZE) {
+    return;
+  }
+
+  uint8_t type = header[4];
+  uint8_t flags = header[5];
+  uint8_t format = header[6];
+  uint32_t length = readLE32(header + 8);
+  uint32_t frameId = readLE32(header + 12);
+  if ((type != TYPE_FULL && type != TYPE_PARTIAL) || format >= FORMATS) {
+    return;
+  }
+  if (length > sizeof(receiveBuffer)) {
+    return;
+  }
+
+  // Compressed payloads go at the end, to be expanded in place
+  uint8_t *payload = (flags & FLAG_RLE) ? receiveBuffer + sizeof(receiveBuffer) - length : receiveBuffer;
+
+  if (readInto(payload, length) != length || readInto(trailer, TRAILER_SIZE) != TRAILER_SIZE) {
+    return;
+  }
+
+  uint32_t crc = updateCrc(0xFFFFFFFF, header, HEADER_SIZE);
+  crc = ~updateCrc(crc, payload, length);
+  if (crc != readLE32(trailer)) {
+    resync(payload, length, trailer);
+    return;
+  }
+
+  // A frame sent again (e.g. resent while frame sync held it) is already on
+  // the LEDs.  Confirm it again in case our ack was lost, but leave it be.
+  if (haveFrame && frameId == currentFrameId) {
+    reply(REPLY_ACK, frameId);
+    return;
+  }
+
+  if (flags & FLAG_RLE) {
+    length = rleDecode(payload, length, receiveBuffer, sizeof(drawingMemory));
+    payload = receiveBuffer;
+  }
+
+  const uint8_t *planes = formatPlanes[format];
+  uint32_t frameSize = ledsPerStrip * columnBytes(planes);
+  if (type == TYPE_FULL ? length != frameSize : length < 8) {
+    reply(REPLY_REJECT, currentFrameId);
+    return;
+  }
+
+  if (type == TYPE_PARTIAL) {
+    // Only safe on top of the frame the host diffed against, or a later one
+    uint32_t baseId = readLE32(payload);
+    if (!haveFrame || (int32_t)(currentFrameId - baseId) < 0 || !applyPartial(payload, length, format)) {
+      reply(REPLY_REJECT, currentFrameId);
+      return;
+    }
+  } else {
+    copyColumns(0, payload, length, format);
+  }
+
+  currentFrameId = frameId;
+  haveFrame = true;
+  reply(REPLY_ACK, frameId);
+
+  showFrame();
+}
+
 void setup() {
   pinMode(12, INPUT_PULLUP); // Frame Sync
   Serial.setTimeout(50);
+  initCrc();
   leds.begin();
   leds.show();
 }
 
 void loop() {
+#if PROTOCOL_VERSION == 2
+  int c = nextByte();
+  if (c < 0) {
+    return;
+  }
+
+  if (c == magic[magicMatched]) {
+    magicMatched++;
+  } else {
+    magicMatched = (c == magic[0]) ? 1 : 0;
+  }
+
+  if (magicMatched == MAGIC_SIZE) {
+    magicMatched = 0;
+    receiveFrame();
+  }
+#else
   int startChar = Serial.read();
 
   if (startChar == '*') {
     int count = Serial.readBytes((char *)drawingMemory, sizeof(drawingMemory));
     if (count == sizeof(drawingMemory)) {
-      digitalWrite(12, HIGH);
-      pinMode(12, OUTPUT);
-      //delayMicroseconds(usToWaitBeforeSyncOutput);
-      digitalWrite(12, LOW);
-      // WS2811 update begins immediately after falling edge of frame sync
-      digitalWrite(13, HIGH);
-      leds.show();
-      digitalWrite(13, LOW);
+      showFrame();
     }
-
   }
+#endif
 }
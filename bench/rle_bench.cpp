@@ -0,0 +1,139 @@
+// FireNode
+// Copyright (c) 2013 Jon Evans
+// http://craftyjon.com/projects/openlights/firenode
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+
+// Replays a show recorded with the "record" config key through the unpacker
+// and reports how well its frames run-length encode, and how fast.
+//
+//   rle_bench <recording> <first-strand> <last-strand>
+
+#include <cstdio>
+
+#include <QtCore/QCoreApplication>
+#include <QtCore/QStringList>
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QObject>
+
+#include "portability.h"
+#include "unpacker.h"
+#include "recording.h"
+#include "rle.h"
+
+
+//! Compresses every assembled frame with both encoders and keeps the totals.
+class Sink : public QObject
+{
+    Q_OBJECT
+
+public:
+    Sink() : frames(0), raw_bytes(0), encoded_bytes(0), simd_ns(0), scalar_ns(0) {}
+
+    int frames;
+    qint64 raw_bytes;
+    qint64 encoded_bytes;
+    qint64 simd_ns;
+    qint64 scalar_ns;
+
+public slots:
+    void frame_ready(const OutputFrame *frame)
+    {
+        const uint8_t *payload = (const uint8_t *)frame->data[FRAME_PAYLOAD];
+        size_t len = frame->length[FRAME_PAYLOAD];
+
+        if (_buffer.size() < (int)RLE_MAX_ENCODED(len)) {
+            _buffer.resize(RLE_MAX_ENCODED(len));
+        }
+        uint8_t *out = (uint8_t *)_buffer.data();
+
+        QElapsedTimer timer;
+        timer.start();
+        size_t encoded = rle_encode(payload, len, out, _buffer.size());
+        simd_ns += timer.nsecsElapsed();
+
+        timer.restart();
+        size_t scalar = rle_encode_scalar(payload, len, out, _buffer.size());
+        scalar_ns += timer.nsecsElapsed();
+
+        if (encoded != scalar) {
+            qWarning("Frame %d: encoders disagree (%d vs %d bytes)", frames, (int)encoded, (int)scalar);
+        }
+
+        frames++;
+        raw_bytes += len;
+        encoded_bytes += encoded;
+    }
+
+private:
+    QByteArray _buffer;
+};
+
+
+static double megabytes_per_second(qint64 bytes, qint64 ns)
+{
+    return ns > 0 ? (bytes / 1e6) / (ns / 1e9) : 0.0;
+}
+
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    QStringList args = app.arguments();
+
+    if (args.size() < 4) {
+        fprintf(stderr, "Usage: rle_bench <recording> <first-strand> <last-strand>\n");
+        return 1;
+    }
+
+    Playback playback(args[1]);
+    if (!playback.is_open()) {
+        return 1;
+    }
+
+    StrandStore store;
+    Unpacker unpacker(args[2].toInt(), args[3].toInt(), &store);
+    Sink sink;
+
+    QObject::connect(&unpacker, SIGNAL(frame_end()), &unpacker, SLOT(assemble_data()));
+    QObject::connect(&unpacker, SIGNAL(data_ready(const OutputFrame*)), &sink, SLOT(frame_ready(const OutputFrame*)));
+
+    qint64 timestamp_us;
+    QByteArray datagram;
+    while (playback.next(&timestamp_us, &datagram)) {
+        unpacker.unpack_data(datagram);
+    }
+
+    if (sink.frames == 0) {
+        fprintf(stderr, "No frames in recording.\n");
+        return 1;
+    }
+
+    printf("frames:      %d\n", sink.frames);
+    printf("raw:         %lld bytes\n", (long long)sink.raw_bytes);
+    printf("encoded:     %lld bytes (%.1f%% of raw)\n", (long long)sink.encoded_bytes,
+           100.0 * sink.encoded_bytes / sink.raw_bytes);
+    printf("rle_encode:  %.1f MB/s\n", megabytes_per_second(sink.raw_bytes, sink.simd_ns));
+    printf("scalar:      %.1f MB/s\n", megabytes_per_second(sink.raw_bytes, sink.scalar_ns));
+
+    return 0;
+}
+
+#include "rle_bench.moc"
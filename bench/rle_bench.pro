@@ -0,0 +1,50 @@
+TEMPLATE = app
+CONFIG += qt console
+TARGET = rle_bench
+QT += core
+QT -= gui
+
+INCLUDEPATH += ../src
+
+SOURCES +=  rle_bench.cpp \
+            ../src/unpacker.cpp \
+            ../src/partial.cpp \
+            ../src/protocol.cpp \
+            ../src/rle.cpp \
+            ../src/transpose.cpp \
+            ../src/remap.cpp \
+            ../src/color_order.cpp \
+            ../src/power.cpp \
+            ../src/high_depth.cpp \
+            ../src/strand_store.cpp \
+            ../src/alloc_tracker.cpp \
+            ../src/frame.cpp \
+            ../src/work_pool.cpp \
+            ../src/pipeline.cpp \
+            ../src/realtime.cpp \
+            ../src/bit_depth.cpp \
+            ../src/interpolate.cpp \
+            ../src/jitter_buffer.cpp \
+            ../src/clock_sync.cpp \
+            ../src/recording.cpp
+
+HEADERS +=  ../src/unpacker.h \
+            ../src/partial.h \
+            ../src/protocol.h \
+            ../src/rle.h \
+            ../src/transpose.h \
+            ../src/remap.h \
+            ../src/color_order.h \
+            ../src/power.h \
+            ../src/high_depth.h \
+            ../src/strand_store.h \
+            ../src/alloc_tracker.h \
+            ../src/frame.h \
+            ../src/work_pool.h \
+            ../src/pipeline.h \
+            ../src/realtime.h \
+            ../src/bit_depth.h \
+            ../src/interpolate.h \
+            ../src/jitter_buffer.h \
+            ../src/clock_sync.h \
+            ../src/recording.h
@@ -0,0 +1,149 @@
+// FireNode
+// Copyright (c) 2013 Jon Evans
+// http://craftyjon.com/projects/openlights/firenode
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+
+// Stands in for FireMix when testing synchronized playout: sends a moving
+// test pattern with presentation timestamps to several nodes over loopback,
+// and answers their clock sync requests.
+//
+//   sync_sender <clock-port> <fps> <latency-ms> <strands> <pixels> <node-port>...
+//
+// Point each node's "clock-server" at 127.0.0.1:<clock-port>.
+
+#include <cstdio>
+#include <cstring>
+
+#include <QtCore/QCoreApplication>
+#include <QtCore/QStringList>
+#include <QtCore/QTimer>
+#include <QtCore/QObject>
+#include <QtNetwork/QUdpSocket>
+
+#include "portability.h"
+#include "clock_sync.h"
+
+
+class Sender : public QObject
+{
+    Q_OBJECT
+
+public:
+    Sender(quint16 clock_port, int latency_ms, int strands, int pixels, const QList<quint16> &nodes)
+        : _latency_us((qint64)latency_ms * 1000), _strands(strands), _pixels(pixels), _nodes(nodes), _frame(0)
+    {
+        _socket.bind(QHostAddress::LocalHost, clock_port);
+        connect(&_socket, SIGNAL(readyRead()), this, SLOT(answer_requests()));
+    }
+
+public slots:
+    void send_frame(void)
+    {
+        send(QByteArray(1, 'B'));
+
+        // One lit pixel chasing along every strand
+        int lit = _frame % _pixels;
+        for (int strand = 0; strand < _strands; strand++) {
+            QByteArray packet(4 + _pixels * 3, 0);
+            packet[0] = 'S';
+            packet[1] = strand;
+            packet[2] = (_pixels * 3) & 0xFF;
+            packet[3] = ((_pixels * 3) >> 8) & 0xFF;
+            packet[4 + lit * 3] = packet[5 + lit * 3] = packet[6 + lit * 3] = (char)0xFF;
+            send(packet);
+        }
+
+        QByteArray end(FRAME_END_PTS_SIZE, 0);
+        end[0] = 'E';
+        write_timestamp(end.data() + 1, monotonic_us() + _latency_us);
+        send(end);
+
+        _frame++;
+    }
+
+    void answer_requests(void)
+    {
+        while (_socket.hasPendingDatagrams()) {
+            QByteArray request;
+            QHostAddress from;
+            quint16 from_port;
+
+            request.resize(_socket.pendingDatagramSize());
+            _socket.readDatagram(request.data(), request.size(), &from, &from_port);
+            qint64 received = monotonic_us();
+
+            if (request.size() < CLOCK_SYNC_REQUEST_SIZE || request.at(0) != CLOCK_SYNC_REQUEST) {
+                continue;
+            }
+
+            QByteArray reply(CLOCK_SYNC_REPLY_SIZE, 0);
+            reply[0] = CLOCK_SYNC_REPLY;
+            memcpy(reply.data() + 1, request.constData() + 1, 8);
+            write_timestamp(reply.data() + 9, received);
+            write_timestamp(reply.data() + 17, monotonic_us());
+            _socket.writeDatagram(reply, from, from_port);
+        }
+    }
+
+private:
+    void send(const QByteArray &packet)
+    {
+        for (int i = 0; i < _nodes.size(); i++) {
+            _socket.writeDatagram(packet, QHostAddress::LocalHost, _nodes[i]);
+        }
+    }
+
+    QUdpSocket _socket;
+    qint64 _latency_us;
+    int _strands;
+    int _pixels;
+    QList<quint16> _nodes;
+    int _frame;
+};
+
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    QStringList args = app.arguments();
+
+    if (args.size() < 7) {
+        fprintf(stderr, "Usage: sync_sender <clock-port> <fps> <latency-ms> <strands> <pixels> <node-port>...\n");
+        return 1;
+    }
+
+    QList<quint16> nodes;
+    for (int i = 6; i < args.size(); i++) {
+        nodes.append(args[i].toUShort());
+    }
+
+    Sender sender(args[1].toUShort(), args[3].toInt(), args[4].toInt(), args[5].toInt(), nodes);
+
+    QTimer timer;
+    timer.setTimerType(Qt::PreciseTimer);
+    timer.setInterval(1000 / args[2].toInt());
+    QObject::connect(&timer, SIGNAL(timeout()), &sender, SLOT(send_frame()));
+    timer.start();
+
+    return app.exec();
+}
+
+#include "sync_sender.moc"
@@ -0,0 +1,12 @@
+TEMPLATE = app
+CONFIG += qt console
+TARGET = sync_sender
+QT += core network
+QT -= gui
+
+INCLUDEPATH += ../src
+
+SOURCES +=  sync_sender.cpp \
+            ../src/clock_sync.cpp
+
+HEADERS +=  ../src/clock_sync.h
@@ -7,15 +7,80 @@ DEFINES += QT_DLL QT_NETWORK_LIB
 SOURCES +=  src/networking.cpp \
             src/main.cpp \
             src/unpacker.cpp \
-            src/serial.cpp
+            src/serial.cpp \
+            src/usb.cpp \
+            src/frame_sync.cpp \
+            src/protocol.cpp \
+            src/partial.cpp \
+            src/rle.cpp \
+            src/transpose.cpp \
+            src/remap.cpp \
+            src/color_order.cpp \
+            src/power.cpp \
+            src/high_depth.cpp \
+            src/strand_store.cpp \
+            src/alloc_tracker.cpp \
+            src/frame.cpp \
+            src/work_pool.cpp \
+            src/pipeline.cpp \
+            src/realtime.cpp \
+            src/bit_depth.cpp \
+            src/interpolate.cpp \
+            src/jitter_buffer.cpp \
+            src/clock_sync.cpp \
+            src/recording.cpp \
+            src/output.cpp
 
 HEADERS +=  src/version.h \
             src/networking.h \
             src/portability.h \
             src/unpacker.h \
             src/serial.h \
+            src/output.h \
+            src/usb.h \
+            src/frame_sync.h \
+            src/protocol.h \
+            src/partial.h \
+            src/rle.h \
+            src/transpose.h \
+            src/remap.h \
+            src/color_order.h \
+            src/power.h \
+            src/high_depth.h \
+            src/strand_store.h \
+            src/alloc_tracker.h \
+            src/frame.h \
+            src/work_pool.h \
+            src/pipeline.h \
+            src/realtime.h \
+            src/bit_depth.h \
+            src/interpolate.h \
+            src/jitter_buffer.h \
+            src/clock_sync.h \
+            src/recording.h \
             src/color_correct.h
 
+# Build with "qmake CONFIG+=libusb" to enable the libusb bulk-transfer backend
+libusb {
+    DEFINES += USE_LIBUSB
+    CONFIG += link_pkgconfig
+    PKGCONFIG += libusb-1.0
+}
+
+# Build with "qmake CONFIG+=alloc_tracking" to fail on heap allocations in steady state
+alloc_tracking {
+    DEFINES += ALLOC_TRACKING
+}
+
+linux {
+    SOURCES += src/tty.cpp \
+               src/hotplug.cpp \
+               src/busy_poll.cpp
+    HEADERS += src/tty.h \
+               src/hotplug.h \
+               src/busy_poll.h
+}
+
 win32 {
     LIBS += -L"../zeromq-4.1.0/bin" -lzmq
     INCLUDEPATH += "../zeromq-4.1.0/include"
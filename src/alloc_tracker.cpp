@@ -0,0 +1,144 @@
+// FireNode
+// Copyright (c) 2013 Jon Evans
+// http://craftyjon.com/projects/openlights/firenode
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+
+#include "alloc_tracker.h"
+
+#ifdef ALLOC_TRACKING
+
+#include <cstddef>
+#include <cerrno>
+
+
+// glibc's own allocator, which the wrappers below forward to
+extern "C" {
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t count, size_t size);
+void *__libc_realloc(void *ptr, size_t size);
+void *__libc_memalign(size_t alignment, size_t size);
+}
+
+static __thread int tracking_depth = 0;
+static __thread int ignore_depth = 0;
+static __thread unsigned long allocations = 0;
+
+
+static inline void count_allocation()
+{
+    if (tracking_depth > 0 && ignore_depth == 0) {
+        allocations++;
+    }
+}
+
+
+// operator new and Qt's containers end up here too
+extern "C" void *malloc(size_t size)
+{
+    count_allocation();
+    return __libc_malloc(size);
+}
+
+
+extern "C" void *calloc(size_t count, size_t size)
+{
+    count_allocation();
+    return __libc_calloc(count, size);
+}
+
+
+extern "C" void *realloc(void *ptr, size_t size)
+{
+    count_allocation();
+    return __libc_realloc(ptr, size);
+}
+
+
+extern "C" void *memalign(size_t alignment, size_t size)
+{
+    count_allocation();
+    return __libc_memalign(alignment, size);
+}
+
+
+extern "C" void *aligned_alloc(size_t alignment, size_t size)
+{
+    count_allocation();
+    return __libc_memalign(alignment, size);
+}
+
+
+extern "C" int posix_memalign(void **ptr, size_t alignment, size_t size)
+{
+    count_allocation();
+    *ptr = __libc_memalign(alignment, size);
+    return (*ptr != NULL) ? 0 : ENOMEM;
+}
+
+
+TrackAllocations::TrackAllocations()
+{
+    tracking_depth++;
+}
+
+
+TrackAllocations::~TrackAllocations()
+{
+    tracking_depth--;
+}
+
+
+IgnoreAllocations::IgnoreAllocations()
+{
+    ignore_depth++;
+}
+
+
+IgnoreAllocations::~IgnoreAllocations()
+{
+    ignore_depth--;
+}
+
+
+AllocationCheck::AllocationCheck(const char *name)
+{
+    _name = name;
+    _frames = 0;
+}
+
+
+void AllocationCheck::frame_done()
+{
+    unsigned long count = allocations;
+    allocations = 0;
+
+    if (_frames < ALLOC_TRACKER_WARMUP_FRAMES) {
+        // Pools are still filling up
+        _frames++;
+        return;
+    }
+
+    if (count > 0) {
+        qFatal("%lu heap allocations in one frame of %s after warmup", count, _name);
+    }
+}
+
+#endif
@@ -0,0 +1,101 @@
+// FireNode
+// Copyright (c) 2013 Jon Evans
+// http://craftyjon.com/projects/openlights/firenode
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+
+#ifndef _ALLOC_TRACKER_H
+#define _ALLOC_TRACKER_H
+
+#include "portability.h"
+
+#include <QtCore/QtGlobal>
+
+
+// Frames (or datagrams) before a heap allocation on the hot path is an error
+#define ALLOC_TRACKER_WARMUP_FRAMES 100
+
+
+// Build with "qmake CONFIG+=alloc_tracking" to count heap allocations on the
+// hot path.  malloc and friends are wrapped for the whole process; only
+// allocations made by a thread inside a TrackAllocations scope (and outside
+// any IgnoreAllocations scope) are counted.  Without it these are all no-ops.
+
+#ifdef ALLOC_TRACKING
+
+//! Counts this thread's heap allocations while alive.  Scopes nest.
+class TrackAllocations
+{
+public:
+    TrackAllocations();
+    ~TrackAllocations();
+};
+
+
+//! Stops counting while alive, e.g. around diagnostics that format strings.
+class IgnoreAllocations
+{
+public:
+    IgnoreAllocations();
+    ~IgnoreAllocations();
+};
+
+
+//! Fails once a frame of the path called name allocated after warmup.
+class AllocationCheck
+{
+public:
+    AllocationCheck(const char *name);
+
+    //! Call once per frame, on the thread that did the tracked work.  Takes
+    //! every allocation counted on this thread since the last call.
+    void frame_done(void);
+
+private:
+    const char *_name;
+    int _frames;
+};
+
+#else
+
+class TrackAllocations
+{
+public:
+    TrackAllocations() {}
+};
+
+
+class IgnoreAllocations
+{
+public:
+    IgnoreAllocations() {}
+};
+
+
+class AllocationCheck
+{
+public:
+    AllocationCheck(const char *name) { Q_UNUSED(name); }
+    void frame_done(void) {}
+};
+
+#endif
+
+#endif
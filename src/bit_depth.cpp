@@ -0,0 +1,152 @@
+// FireNode
+// Copyright (c) 2013 Jon Evans
+// http://craftyjon.com/projects/openlights/firenode
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+
+#include <cstring>
+
+#include <QtCore/QDebug>
+
+#include "bit_depth.h"
+#include "alloc_tracker.h"
+
+
+// Planes of red, green, blue and white
+static const uint8_t source_planes[BIT_DEPTH_FORMATS][BIT_DEPTH_MAX_CHANNELS] = {
+    {8, 8, 8, 8},
+    {5, 6, 5, 6},
+    {4, 4, 4, 4},
+};
+
+
+void bit_depth_planes(uint8_t format, const ColorOrder *order, uint8_t *planes)
+{
+    const uint8_t *depth = source_planes[(format < BIT_DEPTH_FORMATS) ? format : PROTOCOL_FORMAT_888];
+
+    for (int channel = 0; channel < BIT_DEPTH_CHANNELS; channel++) {
+        planes[channel] = depth[order->channel[channel]];
+    }
+    planes[BIT_DEPTH_CHANNELS] = depth[BIT_DEPTH_CHANNELS];
+}
+
+
+size_t bit_depth_column_size(uint8_t format, int channels)
+{
+    // The same in any order
+    const uint8_t *depth = source_planes[(format < BIT_DEPTH_FORMATS) ? format : PROTOCOL_FORMAT_888];
+
+    size_t size = 0;
+    for (int channel = 0; channel < channels; channel++) {
+        size += depth[channel];
+    }
+    return size;
+}
+
+
+void expand_bit_depth(const uint8_t *in, size_t len, const uint8_t *depth, uint8_t *out, int channels)
+{
+    size_t column_size = 0;
+    for (int channel = 0; channel < channels; channel++) {
+        column_size += depth[channel];
+    }
+    size_t columns = len / column_size;
+
+    for (size_t column = 0; column < columns; column++) {
+        for (int channel = 0; channel < channels; channel++) {
+            for (int plane = 0; plane < 8; plane++) {
+                out[plane] = in[plane % depth[channel]];
+            }
+            in += depth[channel];
+            out += 8;
+        }
+    }
+}
+
+
+void TemporalDither::resize(size_t values)
+{
+    if (_error.size() != values) {
+        _error.assign(values, 0);
+    }
+}
+
+
+AdaptiveBitDepth::AdaptiveBitDepth(int channels)
+{
+    _channels = channels;
+    _format = PROTOCOL_FORMAT_888;
+    _sent = 0;
+    _acked = 0;
+    _capacity = 0;
+}
+
+
+void AdaptiveBitDepth::frame_sent(size_t columns)
+{
+    if (!_window.isValid()) {
+        _window.start();
+    }
+    _sent++;
+
+    qint64 elapsed = _window.elapsed();
+    if (elapsed < BIT_DEPTH_WINDOW_MS) {
+        return;
+    }
+
+    double seconds = elapsed / 1000.0;
+    double offered = _sent / seconds;
+    double delivered = _acked / seconds;
+    double carried = delivered * columns * bit_depth_column_size(_format, _channels);
+
+    if (_acked < _sent * BIT_DEPTH_ACK_RATIO) {
+        _capacity = carried;
+
+        if (_format + 1 < BIT_DEPTH_FORMATS) {
+            _format++;
+            IgnoreAllocations ignore;
+            qDebug("Link saturated at %.0f of %.0f fps, dropping to format %d", delivered, offered, _format);
+        }
+    } else {
+        // Whatever it carried without dropping frames, it can carry at least
+        if (carried > _capacity) {
+            _capacity = carried;
+        }
+
+        if (_format > PROTOCOL_FORMAT_888) {
+            double needed = offered * columns * bit_depth_column_size(_format - 1, _channels);
+            if (needed < _capacity * BIT_DEPTH_HEADROOM) {
+                _format--;
+                IgnoreAllocations ignore;
+                qDebug("Link has room for %.0f fps at format %d, stepping up", offered, _format);
+            }
+        }
+    }
+
+    _sent = 0;
+    _acked = 0;
+    _window.restart();
+}
+
+
+void AdaptiveBitDepth::frame_acked()
+{
+    _acked++;
+}
@@ -0,0 +1,158 @@
+// FireNode
+// Copyright (c) 2013 Jon Evans
+// http://craftyjon.com/projects/openlights/firenode
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+
+#ifndef _BIT_DEPTH_H
+#define _BIT_DEPTH_H
+
+#include "portability.h"
+#include "protocol.h"
+#include "color_order.h"
+
+#include <cstddef>
+#include <vector>
+
+#include <QtCore/QElapsedTimer>
+
+
+// Reduced bit-depth frames (the header's format byte).
+//
+// Each channel normally takes 8 bit planes of the pixel column, most
+// significant first.  The reduced formats only send the top planes of each
+// channel, in wire order:
+//
+//   PROTOCOL_FORMAT_888   8/8/8   24 bytes per column
+//   PROTOCOL_FORMAT_565   6/5/5   16 bytes per column (6 bits of green)
+//   PROTOCOL_FORMAT_444   4/4/4   12 bytes per column
+//
+// The 6 planes of 565 go to whichever wire channel carries green in the
+// output's color order, e.g. the first for GRB and the second for RGB.  The
+// receiver must be built for the same one (GREEN_CHANNEL in the sketch).
+//
+// RGBW outputs (src/color_order.h) add white as a fourth channel, with 8, 6
+// and 4 planes: 32, 22 and 16 bytes per column.
+//
+// The receiver rebuilds the missing low planes by bit replication: plane k
+// of a channel with d planes is plane (k mod d), which maps full scale to 255.
+// Sizes are for 8 lanes; wider outputs scale them by lanes / 8 (src/transpose.h).
+// Partial frames use the same packed layout, with columns as the blocks.
+
+#define BIT_DEPTH_FORMATS 3
+#define BIT_DEPTH_CHANNELS 3
+#define BIT_DEPTH_MAX_CHANNELS 4
+
+// Adaptive mode looks at one second of frames at a time
+#define BIT_DEPTH_WINDOW_MS 1000
+// Less than this fraction of frames acknowledged means the link is saturated
+#define BIT_DEPTH_ACK_RATIO 0.9
+// Only step back up if the deeper format needs less than this share of the link
+#define BIT_DEPTH_HEADROOM 0.8
+
+
+//! Fills planes (BIT_DEPTH_MAX_CHANNELS long) with the planes per channel, in
+//! the wire order of order, for a PROTOCOL_FORMAT_* value.
+void bit_depth_planes(uint8_t format, const ColorOrder *order, uint8_t *planes);
+
+//! Bytes per pixel column in that format, for pixels of the given channels.
+size_t bit_depth_column_size(uint8_t format, int channels = BIT_DEPTH_CHANNELS);
+
+//! Host-side reference for the receiver: expands a payload packed with planes
+//! (see bit_depth_planes()) into full 8-bit planes.  out must hold
+//! (len / column size) * channels * 8 bytes.
+void expand_bit_depth(const uint8_t *in, size_t len, const uint8_t *planes, uint8_t *out, int channels = BIT_DEPTH_CHANNELS);
+
+
+//! Replicates the top bits of value down to 8 bits, like the receiver does.
+inline uint8_t expand_bits(int value, int bits)
+{
+    uint8_t out = value << (8 - bits);
+    for (int filled = bits; filled < 8; filled *= 2) {
+        out |= out >> filled;
+    }
+    return out;
+}
+
+
+//! Temporal error diffusion: every value carries the quantization error of the
+//! previous frame's value at the same position, so at LED frame rates the
+//! average brightness matches the 8-bit input and gradients do not band.
+class TemporalDither
+{
+public:
+    void resize(size_t values);
+
+    //! Returns value reduced to its top bits planes (already replicated down).
+    inline uint8_t quantize(size_t index, uint8_t value, int bits)
+    {
+        if (bits >= 8) {
+            return value;
+        }
+
+        // Keep black black instead of flickering with leftover error
+        if (value == 0) {
+            _error[index] = 0;
+            return 0;
+        }
+
+        int levels = (1 << bits) - 1;
+        int target = value + _error[index];
+        int level = (target * levels + 127) / 255;
+        level = (level < 0) ? 0 : (level > levels ? levels : level);
+
+        uint8_t out = expand_bits(level, bits);
+        _error[index] = target - out;
+        return out;
+    }
+
+private:
+    std::vector<int16_t> _error;
+};
+
+
+//! Picks the deepest format the link can carry at the incoming frame rate.
+//!
+//! Every BIT_DEPTH_WINDOW_MS it compares the frames sent to the frames the
+//! receiver acknowledged.  If too many were lost or superseded, the link is
+//! saturated: the bytes per second it did carry become the capacity estimate
+//! and the depth drops one step.  It steps back up once the deeper format fits
+//! in that capacity with some headroom.
+class AdaptiveBitDepth
+{
+public:
+    AdaptiveBitDepth(int channels = BIT_DEPTH_CHANNELS);
+
+    uint8_t format(void) const { return _format; }
+
+    //! Counts a frame of the given pixel columns, and may change format() for the next one.
+    void frame_sent(size_t columns);
+    void frame_acked(void);
+
+private:
+    int _channels;
+    uint8_t _format;
+    int _sent;
+    int _acked;
+    double _capacity;
+    QElapsedTimer _window;
+};
+
+#endif
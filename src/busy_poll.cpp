@@ -0,0 +1,208 @@
+// FireNode
+// Copyright (c) 2013 Jon Evans
+// http://craftyjon.com/projects/openlights/firenode
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+
+#include "busy_poll.h"
+#include "networking.h"
+#include "clock_sync.h"
+#include "alloc_tracker.h"
+
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <linux/sockios.h>
+
+#include <QtCore/QDebug>
+
+
+// Tells the core it is in a spin loop, which saves power and lets a sibling
+// hyperthread run
+static inline void cpu_relax(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+    asm volatile("yield");
+#endif
+}
+
+
+IngestLatency::IngestLatency(const char *path)
+{
+    _path = path;
+    memset(_buckets, 0, sizeof(_buckets));
+    _samples = 0;
+    _max_ns = 0;
+}
+
+
+void IngestLatency::sample(int fd)
+{
+    // The first call turns receive timestamps on and has none to report
+    struct timespec received;
+    if (ioctl(fd, SIOCGSTAMPNS, &received) < 0) {
+        return;
+    }
+
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+
+    qint64 latency_ns = (qint64)(now.tv_sec - received.tv_sec) * 1000000000LL + (now.tv_nsec - received.tv_nsec);
+    latency_ns = qMax(latency_ns, (qint64)0);
+
+    _buckets[qMin(latency_ns / 1000, (qint64)INGEST_LATENCY_MAX_US)]++;
+    _max_ns = qMax(_max_ns, latency_ns);
+    _samples++;
+
+    if (_samples >= INGEST_LATENCY_PACKETS) {
+        print_stats();
+    }
+}
+
+
+void IngestLatency::print_stats()
+{
+    static const double fractions[4] = {0.5, 0.9, 0.99, 0.999};
+    int percentiles[4];
+
+    int seen = 0;
+    int next = 0;
+    for (int us = 0; us <= INGEST_LATENCY_MAX_US && next < 4; us++) {
+        seen += _buckets[us];
+        while (next < 4 && seen >= _samples * fractions[next]) {
+            percentiles[next++] = us;
+        }
+    }
+
+    IgnoreAllocations ignore;
+    qDebug("Ingest wakeup latency (%s): p50 %d us, p90 %d us, p99 %d us, p99.9 %d us, max %lld us",
+           _path, percentiles[0], percentiles[1], percentiles[2], percentiles[3], _max_ns / 1000);
+
+    memset(_buckets, 0, sizeof(_buckets));
+    _samples = 0;
+    _max_ns = 0;
+}
+
+
+BusyPoller::BusyPoller(Networking *net, int fd)
+{
+    _net = net;
+    _fd = fd;
+    _spin_us = BUSY_POLL_DEFAULT_SPIN_US;
+    _latency = NULL;
+    _oversized = 0;
+    _exit = 0;
+}
+
+
+BusyPoller::~BusyPoller()
+{
+    delete _latency;
+}
+
+
+void BusyPoller::set_spin_us(int us)
+{
+    _spin_us = us;
+}
+
+
+void BusyPoller::set_socket_busy_poll(int us)
+{
+    if (us <= 0) {
+        return;
+    }
+
+#ifdef SO_BUSY_POLL
+    // Raising it past net.core.busy_read needs CAP_NET_ADMIN
+    if (setsockopt(_fd, SOL_SOCKET, SO_BUSY_POLL, &us, sizeof(us)) < 0) {
+        qWarning("Could not set SO_BUSY_POLL (%s), spinning in user space only.", strerror(errno));
+    }
+#else
+    qWarning("SO_BUSY_POLL is not available, spinning in user space only.");
+#endif
+}
+
+
+void BusyPoller::set_latency_stats(bool enabled)
+{
+    delete _latency;
+    _latency = enabled ? new IngestLatency("busy poll") : NULL;
+}
+
+
+void BusyPoller::stop()
+{
+    _exit = 1;
+}
+
+
+void BusyPoller::run()
+{
+    qint64 idle_since = monotonic_us();
+
+    while (!_exit.load()) {
+        // Into the next pool buffer, so a datagram is never copied
+        QByteArray &packet = _net->packet_buffer(MAX_PACKET_SIZE);
+        // MSG_TRUNC returns the datagram's real length, so a cut-off one is caught
+        ssize_t size = recv(_fd, packet.data(), MAX_PACKET_SIZE, MSG_DONTWAIT | MSG_TRUNC);
+
+        if (size > MAX_PACKET_SIZE) {
+            if (_oversized++ % BUSY_POLL_OVERSIZE_WARN_EVERY == 0) {
+                qWarning("Dropped a %d byte datagram, the limit is %d (%llu so far).",
+                         (int)size, MAX_PACKET_SIZE, _oversized);
+            }
+            idle_since = monotonic_us();
+            continue;
+        }
+
+        if (size >= 0) {
+            if (_latency) {
+                _latency->sample(_fd);
+            }
+            _net->packet_received(size);
+            idle_since = monotonic_us();
+            continue;
+        }
+
+        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+            qWarning("Busy poll receive failed: %s", strerror(errno));
+            return;
+        }
+
+        if (monotonic_us() - idle_since < _spin_us) {
+            cpu_relax();
+            continue;
+        }
+
+        // Quiet for the whole spin time: sleep until the next datagram, which
+        // starts the spinning again
+        struct pollfd readable;
+        readable.fd = _fd;
+        readable.events = POLLIN;
+        readable.revents = 0;
+        poll(&readable, 1, BUSY_POLL_BLOCK_MS);
+    }
+}
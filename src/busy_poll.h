@@ -0,0 +1,108 @@
+// FireNode
+// Copyright (c) 2013 Jon Evans
+// http://craftyjon.com/projects/openlights/firenode
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+
+#ifndef _BUSY_POLL_H
+#define _BUSY_POLL_H
+
+#include "portability.h"
+#include "realtime.h"
+
+#include <QtCore/QObject>
+#include <QtCore/QThread>
+#include <QtCore/QAtomicInt>
+
+
+// Longest a blocked busy-poll thread takes to notice stop()
+#define BUSY_POLL_BLOCK_MS 100
+
+// Oversized datagrams are dropped; a warning goes out for the first and every this many after
+#define BUSY_POLL_OVERSIZE_WARN_EVERY 1000
+
+// Wakeup latencies are counted in 1 us buckets up to this, longer ones together
+#define INGEST_LATENCY_MAX_US 4096
+#define INGEST_LATENCY_PACKETS 10000
+
+
+class Networking;
+
+
+//! Time from the kernel receiving a datagram to FireNode reading it.
+//!
+//! Reads the kernel's receive timestamp of the last datagram on a socket, so
+//! the Qt event loop and the busy-poll thread are measured the same way.
+//! Prints percentiles every INGEST_LATENCY_PACKETS datagrams.
+class IngestLatency
+{
+public:
+    IngestLatency(const char *path);
+
+    //! Call right after reading a datagram from fd.
+    void sample(int fd);
+
+private:
+    void print_stats(void);
+
+    const char *_path;
+    int _buckets[INGEST_LATENCY_MAX_US + 1];
+    int _samples;
+    qint64 _max_ns;
+};
+
+
+//! Receives on a dedicated thread that never sleeps in the event loop.
+//!
+//! Reads the socket nonblocking in a loop with a pause hint between empty
+//! reads.  Once nothing has arrived for the spin time it blocks in poll(),
+//! and goes back to spinning with the next datagram.  Datagrams go through
+//! Networking exactly as if the event loop had read them.
+class BusyPoller : public QThread
+{
+    Q_OBJECT
+
+public:
+    BusyPoller(Networking *net, int fd);
+    ~BusyPoller();
+
+    //! Microseconds to spin after the last datagram, 0 to block right away.
+    void set_spin_us(int us);
+    //! Asks the kernel to busy-poll the device queue for up to us on each
+    //! read (SO_BUSY_POLL), 0 to leave it to the net.core.busy_read sysctl.
+    void set_socket_busy_poll(int us);
+    void set_latency_stats(bool enabled);
+
+public slots:
+    void stop(void);
+
+protected:
+    void run(void);
+
+private:
+    Networking *_net;
+    int _fd;
+    int _spin_us;
+    IngestLatency *_latency;
+    unsigned long long _oversized;
+    QAtomicInt _exit;
+};
+
+#endif
@@ -0,0 +1,116 @@
+// FireNode
+// Copyright (c) 2013 Jon Evans
+// http://craftyjon.com/projects/openlights/firenode
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+
+#include "clock_sync.h"
+
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QDebug>
+
+
+static QElapsedTimer started_clock()
+{
+    QElapsedTimer clock;
+    clock.start();
+    return clock;
+}
+
+
+qint64 monotonic_us()
+{
+    static const QElapsedTimer clock = started_clock();
+    return clock.nsecsElapsed() / 1000;
+}
+
+
+ClockSync::ClockSync()
+{
+    _sample_count = 0;
+    _next_sample = 0;
+    _offset = 0;
+}
+
+
+void ClockSync::make_request(QByteArray *request) const
+{
+    request->resize(CLOCK_SYNC_REQUEST_SIZE);
+    (*request)[0] = CLOCK_SYNC_REQUEST;
+    write_timestamp(request->data() + 1, monotonic_us());
+}
+
+
+bool ClockSync::handle_reply(const QByteArray &reply)
+{
+    qint64 t4 = monotonic_us();
+
+    if (reply.size() < CLOCK_SYNC_REPLY_SIZE || reply.at(0) != CLOCK_SYNC_REPLY) {
+        return false;
+    }
+
+    qint64 t1 = read_timestamp(reply.constData() + 1);
+    qint64 t2 = read_timestamp(reply.constData() + 9);
+    qint64 t3 = read_timestamp(reply.constData() + 17);
+
+    Sample sample;
+    sample.offset = ((t2 - t1) + (t3 - t4)) / 2;
+    sample.delay = (t4 - t1) - (t3 - t2);
+    if (sample.delay < 0 || t4 < t1) {
+        return false;
+    }
+
+    QMutexLocker locker(&_lock);
+
+    _samples[_next_sample] = sample;
+    _next_sample = (_next_sample + 1) % CLOCK_SYNC_SAMPLES;
+    if (_sample_count < CLOCK_SYNC_SAMPLES) {
+        _sample_count++;
+    }
+
+    // The exchange with the shortest round trip had the least room for asymmetry
+    int best = 0;
+    for (int i = 1; i < _sample_count; i++) {
+        if (_samples[i].delay < _samples[best].delay) {
+            best = i;
+        }
+    }
+
+    if (_sample_count == 1) {
+        qDebug("Clock synced: sender is %lld us ahead, round trip %lld us", sample.offset, sample.delay);
+    }
+    _offset = _samples[best].offset;
+
+    return true;
+}
+
+
+bool ClockSync::synced() const
+{
+    QMutexLocker locker(&_lock);
+    return _sample_count > 0;
+}
+
+
+qint64 ClockSync::to_local_us(qint64 sender_us) const
+{
+    QMutexLocker locker(&_lock);
+    return sender_us - _offset;
+}
@@ -0,0 +1,106 @@
+// FireNode
+// Copyright (c) 2013 Jon Evans
+// http://craftyjon.com/projects/openlights/firenode
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+
+#ifndef _CLOCK_SYNC_H
+#define _CLOCK_SYNC_H
+
+#include "portability.h"
+
+#include <QtCore/QByteArray>
+#include <QtCore/QMutex>
+
+
+// Presentation timestamps and clock sync, carried over the same UDP port as
+// the frame data.  All times are microseconds, 8 bytes little endian.
+//
+//   'E' pts          end of frame; pts (optional) is when the sender wants it
+//                    shown, on the sender's clock
+//   'Q' t1           node -> clock server: request sent at t1 (node clock)
+//   'R' t1 t2 t3     clock server -> node: t1 echoed, request received at t2
+//                    and reply sent at t3 (sender clock)
+//
+// With t4 the time the reply arrived, the sender's clock is ahead of ours by
+// ((t2 - t1) + (t3 - t4)) / 2, give or take half the round trip
+// (t4 - t1) - (t3 - t2).
+
+#define CLOCK_SYNC_REQUEST 'Q'
+#define CLOCK_SYNC_REPLY 'R'
+#define CLOCK_SYNC_REQUEST_SIZE 9
+#define CLOCK_SYNC_REPLY_SIZE 25
+#define FRAME_END_PTS_SIZE 9
+
+#define CLOCK_SYNC_INTERVAL_MS 1000
+// Offset is taken from the fastest of this many recent exchanges, as NTP does
+#define CLOCK_SYNC_SAMPLES 8
+
+
+//! Microseconds on the node's monotonic clock, shared by every thread.
+qint64 monotonic_us(void);
+
+inline qint64 read_timestamp(const char *in)
+{
+    uint64_t value = 0;
+    for (int i = 0; i < 8; i++) {
+        value |= (uint64_t)(uint8_t)in[i] << (8 * i);
+    }
+    return value;
+}
+
+inline void write_timestamp(char *out, qint64 value)
+{
+    for (int i = 0; i < 8; i++) {
+        out[i] = ((uint64_t)value >> (8 * i)) & 0xFF;
+    }
+}
+
+
+//! Estimates the offset between the sender's clock and monotonic_us().
+//! Requests and replies go through Networking; the estimate is read from
+//! the output side, so it is behind a lock.
+class ClockSync
+{
+public:
+    ClockSync();
+
+    void make_request(QByteArray *request) const;
+    //! Takes a CLOCK_SYNC_REPLY datagram.  Returns false if it is malformed.
+    bool handle_reply(const QByteArray &reply);
+
+    bool synced(void) const;
+    //! Converts a sender timestamp to monotonic_us().
+    qint64 to_local_us(qint64 sender_us) const;
+
+private:
+    struct Sample {
+        qint64 offset;
+        qint64 delay;
+    };
+
+    mutable QMutex _lock;
+    Sample _samples[CLOCK_SYNC_SAMPLES];
+    int _sample_count;
+    int _next_sample;
+    qint64 _offset;
+};
+
+#endif
@@ -0,0 +1,167 @@
+// FireNode
+// Copyright (c) 2013 Jon Evans
+// http://craftyjon.com/projects/openlights/firenode
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+
+#include "color_order.h"
+
+#include <algorithm>
+#include <cstring>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_COLOR_ORDER_SSSE3
+#include <tmmintrin.h>
+#endif
+
+
+template <int C0, int C1, int C2>
+static uint32_t reorder_scalar(const uint8_t *src, uint8_t *dst, int pixels)
+{
+    uint32_t sum = 0;
+    for (int i = 0; i < pixels; i++) {
+        dst[3 * i] = src[3 * i + C0];
+        dst[3 * i + 1] = src[3 * i + C1];
+        dst[3 * i + 2] = src[3 * i + C2];
+        sum += src[3 * i] + src[3 * i + 1] + src[3 * i + 2];
+    }
+    return sum;
+}
+
+
+template <int C0, int C1, int C2>
+static uint32_t extract_white_scalar(const uint8_t *src, uint8_t *dst, int pixels)
+{
+    uint32_t sum = 0;
+    for (int i = 0; i < pixels; i++) {
+        uint8_t c0 = src[3 * i + C0];
+        uint8_t c1 = src[3 * i + C1];
+        uint8_t c2 = src[3 * i + C2];
+        uint8_t white = std::min(c0, std::min(c1, c2));
+
+        dst[4 * i] = c0 - white;
+        dst[4 * i + 1] = c1 - white;
+        dst[4 * i + 2] = c2 - white;
+        dst[4 * i + 3] = white;
+        sum += c0 + c1 + c2 - 2 * white;
+    }
+    return sum;
+}
+
+
+#ifdef HAVE_COLOR_ORDER_SSSE3
+// Sums the bytes of v into the two 64-bit halves of sum
+__attribute__((target("ssse3")))
+static inline __m128i accumulate(__m128i sum, __m128i v)
+{
+    return _mm_add_epi64(sum, _mm_sad_epu8(v, _mm_setzero_si128()));
+}
+
+__attribute__((target("ssse3")))
+static inline uint32_t total(__m128i sum)
+{
+    return _mm_cvtsi128_si32(sum) + _mm_cvtsi128_si32(_mm_unpackhi_epi64(sum, sum));
+}
+
+
+// Five pixels per 16-byte load.  The 16th byte is stored as zero and then
+// overwritten by the next store, so only whole vectors that fit are done here.
+template <int C0, int C1, int C2>
+__attribute__((target("ssse3")))
+static uint32_t reorder_ssse3(const uint8_t *src, uint8_t *dst, int pixels)
+{
+    const __m128i shuffle = _mm_setr_epi8(C0, C1, C2, 3 + C0, 3 + C1, 3 + C2, 6 + C0, 6 + C1, 6 + C2,
+                                          9 + C0, 9 + C1, 9 + C2, 12 + C0, 12 + C1, 12 + C2, -1);
+    __m128i sum = _mm_setzero_si128();
+    int bytes = pixels * 3;
+    int i = 0;
+
+    for (; i + 16 <= bytes; i += 15) {
+        __m128i v = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(src + i)), shuffle);
+        _mm_storeu_si128((__m128i *)(dst + i), v);
+        sum = accumulate(sum, v);
+    }
+
+    return total(sum) + reorder_scalar<C0, C1, C2>(src + i, dst + i, pixels - i / 3);
+}
+
+
+// Four pixels per iteration: each is spread into a dword with a zero top byte,
+// which then gets the minimum of the other three.
+template <int C0, int C1, int C2>
+__attribute__((target("ssse3")))
+static uint32_t extract_white_ssse3(const uint8_t *src, uint8_t *dst, int pixels)
+{
+    const __m128i spread = _mm_setr_epi8(C0, C1, C2, -1, 3 + C0, 3 + C1, 3 + C2, -1,
+                                         6 + C0, 6 + C1, 6 + C2, -1, 9 + C0, 9 + C1, 9 + C2, -1);
+    const __m128i low_byte = _mm_set1_epi32(0xFF);
+    __m128i sum = _mm_setzero_si128();
+    int bytes = pixels * 3;
+    int i = 0;
+
+    for (; 3 * i + 16 <= bytes; i += 4) {
+        __m128i color = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(src + 3 * i)), spread);
+
+        __m128i white = _mm_min_epu8(color, _mm_srli_epi32(color, 8));
+        white = _mm_min_epu8(white, _mm_srli_epi32(color, 16));
+        white = _mm_and_si128(white, low_byte);
+
+        __m128i spread_white = _mm_or_si128(white, _mm_or_si128(_mm_slli_epi32(white, 8), _mm_slli_epi32(white, 16)));
+        __m128i out = _mm_or_si128(_mm_subs_epu8(color, spread_white), _mm_slli_epi32(white, 24));
+        _mm_storeu_si128((__m128i *)(dst + 4 * i), out);
+        sum = accumulate(sum, out);
+    }
+
+    return total(sum) + extract_white_scalar<C0, C1, C2>(src + 3 * i, dst + 4 * i, pixels - i);
+}
+
+static bool color_order_have_ssse3 = __builtin_cpu_supports("ssse3");
+
+#define COLOR_ORDER_KERNEL(kind, c0, c1, c2) \
+    (color_order_have_ssse3 ? kind##_ssse3<c0, c1, c2> : kind##_scalar<c0, c1, c2>)
+#else
+#define COLOR_ORDER_KERNEL(kind, c0, c1, c2) kind##_scalar<c0, c1, c2>
+#endif
+
+#define COLOR_ORDER(name, c0, c1, c2) \
+    {name, {c0, c1, c2}, 3, COLOR_ORDER_KERNEL(reorder, c0, c1, c2)}, \
+    {name "W", {c0, c1, c2}, 4, COLOR_ORDER_KERNEL(extract_white, c0, c1, c2)}
+
+
+static const ColorOrder color_orders[] = {
+    COLOR_ORDER("RGB", 0, 1, 2),
+    COLOR_ORDER("RBG", 0, 2, 1),
+    COLOR_ORDER("GRB", 1, 0, 2),
+    COLOR_ORDER("GBR", 1, 2, 0),
+    COLOR_ORDER("BRG", 2, 0, 1),
+    COLOR_ORDER("BGR", 2, 1, 0),
+};
+
+
+const ColorOrder *find_color_order(const QString name)
+{
+    for (size_t i = 0; i < sizeof(color_orders) / sizeof(color_orders[0]); i++) {
+        if (name.toUpper() == color_orders[i].name) {
+            return &color_orders[i];
+        }
+    }
+
+    return NULL;
+}
@@ -0,0 +1,61 @@
+// FireNode
+// Copyright (c) 2013 Jon Evans
+// http://craftyjon.com/projects/openlights/firenode
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+
+#ifndef _COLOR_ORDER_H
+#define _COLOR_ORDER_H
+
+#include "portability.h"
+
+#include <QtCore/QString>
+
+
+// Strand data arrives as RGB.  Each LED type wants its own byte order on the
+// wire; this rearranges pixels with one kernel per order, picked at startup.
+//
+// RGBW orders (e.g. "GRBW" for SK6812) add a white byte to every pixel.  White
+// is the smallest of the three channels, which is then taken out of each of
+// them: W = min(R, G, B), R' = R - W, G' = G - W, B' = B - W.
+
+#define COLOR_ORDER_DEFAULT "GRB"
+
+
+//! Converts RGB pixels from src into dst, pixel_size bytes each.  Returns the
+//! sum of the bytes written, for power estimates (src/power.h).
+typedef uint32_t (*ColorOrderKernel)(const uint8_t *src, uint8_t *dst, int pixels);
+
+struct ColorOrder
+{
+    const char *name;
+    //! Source channel (0 = R, 1 = G, 2 = B) for each color byte of a pixel on the wire
+    uint8_t channel[3];
+    //! 3, or 4 with white last
+    int pixel_size;
+    //! SSSE3 pshufb kernel where the CPU has it, plain C++ otherwise
+    ColorOrderKernel kernel;
+};
+
+
+//! Looks up an order by name, e.g. "GRB" or "GRBW".  Returns NULL if there is no such order.
+const ColorOrder *find_color_order(const QString name);
+
+#endif
@@ -0,0 +1,96 @@
+// FireNode
+// Copyright (c) 2013 Jon Evans
+// http://craftyjon.com/projects/openlights/firenode
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+
+#include "frame.h"
+
+#include <cstring>
+
+
+void FrameBuffer::reserve(int bytes)
+{
+    _segment[FRAME_HEADER].reserve(FRAME_MAX_FRAMING);
+    _segment[FRAME_PAYLOAD].reserve(bytes);
+    _segment[FRAME_TRAILER].reserve(FRAME_MAX_FRAMING);
+}
+
+
+void FrameBuffer::assign(const OutputFrame &frame)
+{
+    for (int i = 0; i < FRAME_SEGMENTS; i++) {
+        if (_segment[i].size() != frame.length[i]) {
+            _segment[i].resize(frame.length[i]);
+        }
+        if (frame.length[i] > 0) {
+            memcpy(_segment[i].data(), frame.data[i], frame.length[i]);
+        }
+    }
+}
+
+
+void FrameBuffer::swap(FrameBuffer &other)
+{
+    for (int i = 0; i < FRAME_SEGMENTS; i++) {
+        _segment[i].swap(other._segment[i]);
+    }
+}
+
+
+int FrameBuffer::size() const
+{
+    return _segment[FRAME_HEADER].size() + _segment[FRAME_PAYLOAD].size() + _segment[FRAME_TRAILER].size();
+}
+
+
+OutputFrame FrameBuffer::view(int offset, int end) const
+{
+    OutputFrame frame;
+    int start = 0;
+
+    if (end < 0) {
+        end = size();
+    }
+
+    // Each segment clipped to [offset, end)
+    for (int i = 0; i < FRAME_SEGMENTS; i++) {
+        int length = _segment[i].size();
+        int from = qBound(0, offset - start, length);
+        int to = qBound(0, end - start, length);
+
+        frame.data[i] = _segment[i].constData() + from;
+        frame.length[i] = qMax(0, to - from);
+        start += length;
+    }
+
+    return frame;
+}
+
+
+void FrameBuffer::read(int offset, char *out, int len) const
+{
+    OutputFrame frame = view(offset, offset + len);
+
+    for (int i = 0; i < FRAME_SEGMENTS; i++) {
+        memcpy(out, frame.data[i], frame.length[i]);
+        out += frame.length[i];
+    }
+}
@@ -0,0 +1,76 @@
+// FireNode
+// Copyright (c) 2013 Jon Evans
+// http://craftyjon.com/projects/openlights/firenode
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+
+#ifndef _FRAME_H
+#define _FRAME_H
+
+#include "portability.h"
+
+#include <QtCore/QByteArray>
+
+
+// Segments of a frame, in the order they go out
+#define FRAME_HEADER 0
+#define FRAME_PAYLOAD 1
+#define FRAME_TRAILER 2
+#define FRAME_SEGMENTS 3
+
+// Room kept for the header and trailer of a frame, each
+#define FRAME_MAX_FRAMING 64
+
+
+//! A frame as it goes out on the link: header, payload and trailer, each left
+//! in the buffer it was built in.  Framing is written next to the payload and
+//! the pieces gathered on write, so adding to it never moves the payload.
+struct OutputFrame
+{
+    const char *data[FRAME_SEGMENTS];
+    int length[FRAME_SEGMENTS];
+
+    int size(void) const { return length[FRAME_HEADER] + length[FRAME_PAYLOAD] + length[FRAME_TRAILER]; }
+};
+
+
+//! An output's own copy of a frame, kept in the same segments.
+class FrameBuffer
+{
+public:
+    //! Preallocates for payloads of up to bytes so assign() never allocates.
+    void reserve(int bytes);
+    //! Copies frame in.
+    void assign(const OutputFrame &frame);
+    void swap(FrameBuffer &other);
+
+    int size(void) const;
+    bool is_empty(void) const { return size() == 0; }
+
+    //! The bytes from offset up to end (-1 for all), as segments.
+    OutputFrame view(int offset = 0, int end = -1) const;
+    //! Copies len bytes from offset on into out.
+    void read(int offset, char *out, int len) const;
+
+private:
+    QByteArray _segment[FRAME_SEGMENTS];
+};
+
+#endif
@@ -0,0 +1,205 @@
+// FireNode
+// Copyright (c) 2013 Jon Evans
+// http://craftyjon.com/projects/openlights/firenode
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#include "frame_sync.h"
+
+#include <QtCore/QThread>
+
+
+FrameSync::FrameSync(int margin_us)
+{
+    _clock.start();
+    _margin = (qint64)margin_us * 1000;
+    _participants = 0;
+    _arrived = 0;
+    _generation = 0;
+    _timeouts = 0;
+    _deadline = 0;
+}
+
+
+int FrameSync::add_participant()
+{
+    QMutexLocker locker(&_lock);
+    return _participants++;
+}
+
+
+qint64 FrameSync::now() const
+{
+    return _clock.nsecsElapsed();
+}
+
+
+unsigned long long FrameSync::arrive_async()
+{
+    QMutexLocker locker(&_lock);
+    unsigned long long generation = _generation;
+
+    if (++_arrived >= _participants) {
+        release();
+    }
+
+    return generation;
+}
+
+
+bool FrameSync::released(unsigned long long ticket, qint64 arrived_at, qint64 *deadline)
+{
+    QMutexLocker locker(&_lock);
+
+    if (ticket == _generation) {
+        if (now() - arrived_at < (qint64)FRAME_SYNC_TIMEOUT_MS * 1000000) {
+            return false;
+        }
+        // Someone has nothing to send this frame.  Don't hold everyone else hostage.
+        _timeouts++;
+        release();
+    }
+
+    *deadline = _deadline;
+    return true;
+}
+
+
+void FrameSync::release()
+{
+    // Called with _lock held
+    _deadline = now() + _margin;
+    _arrived = 0;
+    _generation++;
+
+    if (_generation % FRAME_SYNC_STATS_FRAMES == 0) {
+        print_stats();
+    }
+}
+
+
+void FrameSync::wait_until(qint64 deadline) const
+{
+    // Sleep most of the way, then spin so the release is as tight as we can make it
+    qint64 remaining = deadline - now();
+    if (remaining > FRAME_SYNC_SPIN_US * 1000) {
+        QThread::usleep((remaining / 1000) - FRAME_SYNC_SPIN_US);
+    }
+
+    while (now() < deadline) {}
+}
+
+
+void FrameSync::report(int output, qint64 skew)
+{
+    QMutexLocker locker(&_lock);
+
+    while (_skew.size() <= output) {
+        Skew empty = {0, 0, 0};
+        _skew.append(empty);
+    }
+
+    Skew &s = _skew[output];
+    s.total += skew;
+    s.max = qMax(s.max, skew);
+    s.count++;
+}
+
+
+void FrameSync::print_stats()
+{
+    qDebug("Frame sync: %llu frames, %llu timeouts", _generation, _timeouts);
+
+    for (int i = 0; i < _skew.size(); i++) {
+        Skew &s = _skew[i];
+        if (s.count == 0) {
+            continue;
+        }
+
+        qDebug("  output %d: skew avg %lld us, max %lld us", i,
+               (s.total / (qint64)s.count) / 1000, s.max / 1000);
+
+        s.total = 0;
+        s.max = 0;
+        s.count = 0;
+    }
+}
+
+
+SyncGroup::SyncGroup(FrameSync *sync)
+{
+    _sync = sync;
+    _sync->add_participant();
+    _pending = false;
+    _ticket = 0;
+    _arrived_at = 0;
+
+    _poll = new QTimer(this);
+    _poll->setInterval(0);
+    connect(_poll, SIGNAL(timeout()), this, SLOT(poll_release()));
+}
+
+
+void SyncGroup::add_output(Output *output, int id)
+{
+    _outputs.append(output);
+    _ids.append(id);
+}
+
+
+void SyncGroup::commit()
+{
+    bool any_held = false;
+    for (int i = 0; i < _outputs.size(); i++) {
+        any_held = any_held || _outputs[i]->holding_frame();
+    }
+
+    if (_pending || !any_held) {
+        return;
+    }
+
+    _arrived_at = _sync->now();
+    _ticket = _sync->arrive_async();
+    _pending = true;
+    _poll->start();
+
+    // Last to arrive releases straight away
+    poll_release();
+}
+
+
+void SyncGroup::poll_release()
+{
+    qint64 deadline;
+    if (!_pending || !_sync->released(_ticket, _arrived_at, &deadline)) {
+        return;
+    }
+
+    _pending = false;
+    _poll->stop();
+
+    // At most the release margin away
+    _sync->wait_until(deadline);
+
+    for (int i = 0; i < _outputs.size(); i++) {
+        if (_outputs[i]->release_frame()) {
+            _sync->report(_ids[i], _sync->now() - deadline);
+        }
+    }
+}
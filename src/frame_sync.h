@@ -0,0 +1,120 @@
+// FireNode
+// Copyright (c) 2013 Jon Evans
+// http://craftyjon.com/projects/openlights/firenode
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#ifndef _FRAME_SYNC_H
+#define _FRAME_SYNC_H
+
+#include "portability.h"
+#include "output.h"
+
+#include <QtCore/QObject>
+#include <QtCore/QDebug>
+#include <QtCore/QList>
+#include <QtCore/QMutex>
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QTimer>
+
+
+#define FRAME_SYNC_MARGIN_US 500
+#define FRAME_SYNC_TIMEOUT_MS 50
+#define FRAME_SYNC_DRAIN_TIMEOUT_MS 20
+#define FRAME_SYNC_SPIN_US 200
+#define FRAME_SYNC_STATS_FRAMES 1000
+
+
+//! Barrier that lets every writer release frame N against one shared deadline.
+//!
+//! Writers send all but the last byte of a frame, then arrive_async() and poll
+//! released().  Once every participant is in (or FRAME_SYNC_TIMEOUT_MS passes)
+//! they all get the same deadline, wait for it, and send their held-back bytes.
+//! Nobody blocks on the barrier itself, so writers keep servicing their ports.
+//! Each output reports how far from the deadline its byte actually went out.
+class FrameSync
+{
+public:
+    FrameSync(int margin_us);
+
+    int add_participant(void);
+
+    //! Monotonic nanoseconds, shared by all participants.
+    qint64 now(void) const;
+    //! Returns at once with a ticket for released().
+    unsigned long long arrive_async(void);
+    //! True once the ticket's frame has been released, with its deadline.
+    //! Releases everyone once the ticket is FRAME_SYNC_TIMEOUT_MS old.
+    bool released(unsigned long long ticket, qint64 arrived_at, qint64 *deadline);
+    void wait_until(qint64 deadline) const;
+    void report(int output, qint64 skew);
+
+private:
+    void release(void);
+    void print_stats(void);
+
+    QElapsedTimer _clock;
+    qint64 _margin;
+
+    QMutex _lock;
+    int _participants;
+    int _arrived;
+    unsigned long long _generation;
+    unsigned long long _timeouts;
+    qint64 _deadline;
+
+    struct Skew {
+        qint64 total;
+        qint64 max;
+        unsigned long long count;
+    };
+    QList<Skew> _skew;
+};
+
+
+//! Frame-sync participant for the outputs written from the main thread's timer.
+//!
+//! The main thread must not block on the barrier, so commit() only arrives and
+//! a zero-interval timer polls for the release while the frame is held.
+class SyncGroup : public QObject
+{
+    Q_OBJECT
+
+public:
+    SyncGroup(FrameSync *sync);
+
+    void add_output(Output *output, int id);
+
+public slots:
+    void commit(void);
+
+private slots:
+    void poll_release(void);
+
+private:
+    FrameSync *_sync;
+    QTimer *_poll;
+    bool _pending;
+    unsigned long long _ticket;
+    qint64 _arrived_at;
+    QList<Output *> _outputs;
+    QList<int> _ids;
+};
+
+#endif
@@ -0,0 +1,131 @@
+// FireNode
+// Copyright (c) 2013 Jon Evans
+// http://craftyjon.com/projects/openlights/firenode
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+
+#include "high_depth.h"
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(__SSE2__)
+#define HAVE_DITHER_SSE2
+#include <emmintrin.h>
+#endif
+
+
+std::vector<uint16_t> high_depth_gamma_table(double gamma)
+{
+    std::vector<uint16_t> table(HIGH_DEPTH_GAMMA_ENTRIES);
+    const int top = HIGH_DEPTH_GAMMA_ENTRIES - 1;
+
+    for (int i = 0; i <= top; i++) {
+        table[i] = (uint16_t)lround(pow((double)i / top, gamma) * 65535);
+    }
+
+    return table;
+}
+
+
+static inline uint16_t read_channel(const uint8_t *src, const uint16_t *gamma)
+{
+    uint16_t value = src[0] | (src[1] << 8);
+    return gamma ? apply_gamma(gamma, value) : value;
+}
+
+
+void unpack_high_depth(const uint8_t *src, int src_pixels, const int32_t *table, int pixels,
+                       const ColorOrder *order, const uint16_t *gamma, uint16_t *out)
+{
+    int pixel_size = order->pixel_size;
+
+    for (int i = 0; i < pixels; i++) {
+        int pixel = table ? table[i] / 3 : i;
+        uint16_t *dst = out + i * pixel_size;
+
+        if (pixel < 0 || pixel >= src_pixels) {
+            std::fill(dst, dst + pixel_size, 0);
+            continue;
+        }
+
+        const uint8_t *rgb = src + pixel * 6;
+        uint16_t c0 = read_channel(rgb + 2 * order->channel[0], gamma);
+        uint16_t c1 = read_channel(rgb + 2 * order->channel[1], gamma);
+        uint16_t c2 = read_channel(rgb + 2 * order->channel[2], gamma);
+
+        if (pixel_size == 4) {
+            uint16_t white = std::min(c0, std::min(c1, c2));
+            c0 -= white;
+            c1 -= white;
+            c2 -= white;
+            dst[3] = white;
+        }
+        dst[0] = c0;
+        dst[1] = c1;
+        dst[2] = c2;
+    }
+}
+
+
+uint32_t dither_high_depth_scalar(const uint16_t *in, uint8_t *error, uint8_t *out, size_t len)
+{
+    uint32_t sum = 0;
+
+    for (size_t i = 0; i < len; i++) {
+        // Saturates like the SSE2 version; full scale comes out as 255 either way
+        uint32_t value = std::min(in[i] + error[i], 0xFFFF);
+        out[i] = value >> 8;
+        error[i] = value & 0xFF;
+        sum += out[i];
+    }
+
+    return sum;
+}
+
+
+uint32_t dither_high_depth(const uint16_t *in, uint8_t *error, uint8_t *out, size_t len)
+{
+#ifdef HAVE_DITHER_SSE2
+    // 16 channels at a time: add the carried remainder, keep the top byte as
+    // the output and the bottom byte as the next remainder
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i low_byte = _mm_set1_epi16(0xFF);
+    __m128i sum = zero;
+
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16) {
+        __m128i carried = _mm_loadu_si128((const __m128i *)(error + i));
+        __m128i lo = _mm_adds_epu16(_mm_loadu_si128((const __m128i *)(in + i)), _mm_unpacklo_epi8(carried, zero));
+        __m128i hi = _mm_adds_epu16(_mm_loadu_si128((const __m128i *)(in + i + 8)), _mm_unpackhi_epi8(carried, zero));
+
+        __m128i value = _mm_packus_epi16(_mm_srli_epi16(lo, 8), _mm_srli_epi16(hi, 8));
+        _mm_storeu_si128((__m128i *)(out + i), value);
+        _mm_storeu_si128((__m128i *)(error + i),
+                         _mm_packus_epi16(_mm_and_si128(lo, low_byte), _mm_and_si128(hi, low_byte)));
+        sum = _mm_add_epi64(sum, _mm_sad_epu8(value, zero));
+    }
+
+    uint32_t total = _mm_cvtsi128_si32(sum) + _mm_cvtsi128_si32(_mm_unpackhi_epi64(sum, sum));
+    return total + dither_high_depth_scalar(in + i, error + i, out + i, len - i);
+#else
+    return dither_high_depth_scalar(in, error, out, len);
+#endif
+}
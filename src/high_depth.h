@@ -0,0 +1,83 @@
+// FireNode
+// Copyright (c) 2013 Jon Evans
+// http://craftyjon.com/projects/openlights/firenode
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+
+#ifndef _HIGH_DEPTH_H
+#define _HIGH_DEPTH_H
+
+#include "portability.h"
+#include "color_order.h"
+
+#include <cstddef>
+#include <vector>
+
+
+// High-depth strand data, for senders that have more than 8 bits per channel.
+//
+//   'H' strand len_lo len_hi data    like 'S', but each channel is 16 bits
+//                                    little endian: 6 bytes per RGB pixel
+//
+// Channels go through the output's gamma curve at 16 bits as they are
+// unpacked, and stay at 16 bits through the jitter buffer and interpolator;
+// 8-bit strands of the same output are widened to match.  Each frame handed
+// on to the output is then dithered down to 8 bits: every channel carries over the remainder of its
+// previous frame, so over a few frames the LEDs average out to the 16-bit
+// level instead of stepping through the 8-bit ones.  That only hides the
+// flicker at high frame rates.
+
+#define HIGH_DEPTH_STRAND 'H'
+
+// 16-bit gamma is interpolated from a table of 4097 points
+#define HIGH_DEPTH_GAMMA_BITS 12
+#define HIGH_DEPTH_GAMMA_ENTRIES ((1 << HIGH_DEPTH_GAMMA_BITS) + 1)
+
+
+//! Builds the gamma table for out = in ^ gamma, HIGH_DEPTH_GAMMA_ENTRIES long.
+std::vector<uint16_t> high_depth_gamma_table(double gamma);
+
+inline uint16_t apply_gamma(const uint16_t *table, uint16_t value)
+{
+    // Scaled so that 0xFFFF lands exactly on the last entry
+    uint32_t position = (uint32_t)value * (HIGH_DEPTH_GAMMA_ENTRIES - 1);
+    uint32_t index = position / 0xFFFF;
+    int64_t fraction = position % 0xFFFF;
+    if (fraction == 0) {
+        return table[index];
+    }
+    return table[index] + (table[index + 1] - table[index]) * fraction / 0xFFFF;
+}
+
+//! Converts pixels of 16-bit RGB from src (src_pixels long) into out, in the
+//! byte order of order and with white extracted for RGBW orders.  Pixel i
+//! comes from src pixel table[i] / 3 (see compile_remap()), or i if table is
+//! NULL.  gamma may be NULL for a linear response.
+void unpack_high_depth(const uint8_t *src, int src_pixels, const int32_t *table, int pixels,
+                       const ColorOrder *order, const uint16_t *gamma, uint16_t *out);
+
+//! Dithers len 16-bit channels down to 8 bits.  error holds each channel's
+//! remainder from the previous call, and starts at zero.  Uses SSE2 where
+//! available.  Returns the sum of out, like a ColorOrderKernel.
+uint32_t dither_high_depth(const uint16_t *in, uint8_t *error, uint8_t *out, size_t len);
+//! Plain C++ version producing the same output.
+uint32_t dither_high_depth_scalar(const uint16_t *in, uint8_t *error, uint8_t *out, size_t len);
+
+#endif
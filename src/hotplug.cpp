@@ -0,0 +1,167 @@
+// FireNode
+// Copyright (c) 2013 Jon Evans
+// http://craftyjon.com/projects/openlights/firenode
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#include "hotplug.h"
+
+#include <cerrno>
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+
+
+Hotplug::Hotplug()
+{
+    _notifier = NULL;
+
+    _fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (_fd < 0) {
+        qWarning("Could not set up hotplug detection: %s", strerror(errno));
+    }
+}
+
+
+Hotplug::~Hotplug()
+{
+    if (_notifier) { _notifier->deleteLater(); }
+    if (_fd >= 0) { ::close(_fd); }
+}
+
+
+void Hotplug::add_output(const QString serial_number, Output *output)
+{
+    _serial_numbers.append(serial_number);
+    _outputs.append(output);
+    _paths.append(QString());
+
+    // Until the device shows up the output stays closed and leaves reopening to us
+    output->device_removed();
+}
+
+
+void Hotplug::start()
+{
+    if (_fd < 0) {
+        return;
+    }
+
+    _notifier = new QSocketNotifier(_fd, QSocketNotifier::Read, this);
+    connect(_notifier, SIGNAL(activated(int)), this, SLOT(read_events()));
+
+    update_watches();
+    rescan();
+}
+
+
+void Hotplug::update_watches()
+{
+    // /dev/serial/by-id only exists while something is plugged in, so also watch
+    // for it (and its parent) being created.  Re-adding an existing watch is harmless.
+    inotify_add_watch(_fd, HOTPLUG_DEV_DIR, IN_CREATE | IN_ONLYDIR);
+    inotify_add_watch(_fd, HOTPLUG_SERIAL_DIR, IN_CREATE | IN_ONLYDIR);
+    inotify_add_watch(_fd, HOTPLUG_BY_ID_DIR, IN_CREATE | IN_DELETE | IN_MOVED_TO | IN_MOVED_FROM | IN_ONLYDIR);
+}
+
+
+void Hotplug::read_events()
+{
+    char buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    bool changed = false;
+
+    for (;;) {
+        ssize_t len = ::read(_fd, buffer, sizeof(buffer));
+        if (len <= 0) {
+            break;
+        }
+
+        for (char *ptr = buffer; ptr < buffer + len; ) {
+            struct inotify_event *event = (struct inotify_event *)ptr;
+            ptr += sizeof(struct inotify_event) + event->len;
+
+            // /dev sees a lot of traffic we don't care about
+            if (event->len > 0 && (event->mask & IN_CREATE) && (event->mask & IN_ISDIR)
+                    && strcmp(event->name, "serial") != 0 && strcmp(event->name, "by-id") != 0) {
+                continue;
+            }
+
+            changed = true;
+        }
+    }
+
+    if (changed) {
+        update_watches();
+        rescan();
+    }
+}
+
+
+void Hotplug::rescan()
+{
+    QList<QString> found;
+    for (int i = 0; i < _outputs.size(); i++) {
+        found.append(QString());
+    }
+
+    DIR *dir = opendir(HOTPLUG_BY_ID_DIR);
+    if (dir != NULL) {
+        struct dirent *entry;
+
+        while ((entry = readdir(dir)) != NULL) {
+            // e.g. usb-Teensyduino_USB_Serial_1234560-if00
+            QString name = QString::fromLocal8Bit(entry->d_name);
+
+            for (int i = 0; i < _outputs.size(); i++) {
+                if (!name.contains("_" + _serial_numbers[i] + "-if")) {
+                    continue;
+                }
+
+                QString link = QString(HOTPLUG_BY_ID_DIR) + "/" + name;
+                char target[PATH_MAX];
+                if (realpath(link.toLocal8Bit().constData(), target) != NULL) {
+                    found[i] = QString::fromLocal8Bit(target);
+                }
+            }
+        }
+
+        closedir(dir);
+    }
+
+    for (int i = 0; i < _outputs.size(); i++) {
+        if (found[i] == _paths[i]) {
+            continue;
+        }
+
+        if (!_paths[i].isEmpty()) {
+            qDebug() << "Device" << _serial_numbers[i] << "removed from" << _paths[i];
+            _outputs[i]->device_removed();
+        }
+
+        if (!found[i].isEmpty()) {
+            qDebug() << "Device" << _serial_numbers[i] << "added at" << found[i];
+            _outputs[i]->device_added(found[i]);
+        }
+
+        _paths[i] = found[i];
+    }
+}
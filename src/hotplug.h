@@ -0,0 +1,69 @@
+// FireNode
+// Copyright (c) 2013 Jon Evans
+// http://craftyjon.com/projects/openlights/firenode
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#ifndef _HOTPLUG_H
+#define _HOTPLUG_H
+
+#include "output.h"
+
+#include <QtCore/QObject>
+#include <QtCore/QDebug>
+#include <QtCore/QList>
+#include <QtCore/QSocketNotifier>
+
+
+#define HOTPLUG_DEV_DIR "/dev"
+#define HOTPLUG_SERIAL_DIR "/dev/serial"
+#define HOTPLUG_BY_ID_DIR "/dev/serial/by-id"
+
+
+//! Watches /dev/serial/by-id and opens or closes outputs as their devices come and go.
+//!
+//! Outputs are matched by USB serial number, so a Teensy keeps its output no
+//! matter which ttyACM node it lands on.
+class Hotplug : public QObject
+{
+    Q_OBJECT
+
+public:
+    Hotplug();
+    ~Hotplug();
+
+    void add_output(const QString serial_number, Output *output);
+    void start(void);
+
+private slots:
+    void read_events(void);
+
+private:
+    void update_watches(void);
+    void rescan(void);
+
+    int _fd;
+    QSocketNotifier *_notifier;
+
+    QList<QString> _serial_numbers;
+    QList<Output *> _outputs;
+    QList<QString> _paths;
+};
+
+#endif
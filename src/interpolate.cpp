@@ -0,0 +1,212 @@
+// FireNode
+// Copyright (c) 2013 Jon Evans
+// http://craftyjon.com/projects/openlights/firenode
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+
+#include "interpolate.h"
+
+#include <cstring>
+
+#if defined(__SSE2__)
+#define HAVE_BLEND_SSE2
+#include <emmintrin.h>
+#endif
+
+
+void blend_channels_scalar(const uint8_t *a, const uint8_t *b, uint8_t *out, size_t len, int weight)
+{
+    int inverse = INTERPOLATE_ONE - weight;
+
+    for (size_t i = 0; i < len; i++) {
+        out[i] = (a[i] * inverse + b[i] * weight + 128) >> 8;
+    }
+}
+
+
+void blend_channels(const uint8_t *a, const uint8_t *b, uint8_t *out, size_t len, int weight)
+{
+#ifdef HAVE_BLEND_SSE2
+    // 16 channels at a time, widened to 16 bits.  255 * 256 + 128 still fits.
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i w = _mm_set1_epi16(weight);
+    const __m128i inverse = _mm_set1_epi16(INTERPOLATE_ONE - weight);
+    const __m128i round = _mm_set1_epi16(128);
+
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16) {
+        __m128i va = _mm_loadu_si128((const __m128i *)(a + i));
+        __m128i vb = _mm_loadu_si128((const __m128i *)(b + i));
+
+        __m128i lo = _mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(va, zero), inverse),
+                                   _mm_mullo_epi16(_mm_unpacklo_epi8(vb, zero), w));
+        __m128i hi = _mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(va, zero), inverse),
+                                   _mm_mullo_epi16(_mm_unpackhi_epi8(vb, zero), w));
+        lo = _mm_srli_epi16(_mm_add_epi16(lo, round), 8);
+        hi = _mm_srli_epi16(_mm_add_epi16(hi, round), 8);
+
+        _mm_storeu_si128((__m128i *)(out + i), _mm_packus_epi16(lo, hi));
+    }
+
+    blend_channels_scalar(a + i, b + i, out + i, len - i, weight);
+#else
+    blend_channels_scalar(a, b, out, len, weight);
+#endif
+}
+
+
+void blend_channels16_scalar(const uint16_t *a, const uint16_t *b, uint16_t *out, size_t len, int weight)
+{
+    uint32_t inverse = INTERPOLATE_ONE - weight;
+
+    for (size_t i = 0; i < len; i++) {
+        out[i] = (a[i] * inverse + b[i] * (uint32_t)weight + 128) >> 8;
+    }
+}
+
+
+void blend_channels16(const uint16_t *a, const uint16_t *b, uint16_t *out, size_t len, int weight)
+{
+#ifdef HAVE_BLEND_SSE2
+    // 8 channels at a time, widened to 32 bits.  65535 * 256 + 128 still fits.
+    const __m128i w = _mm_set1_epi16(weight);
+    const __m128i inverse = _mm_set1_epi16(INTERPOLATE_ONE - weight);
+    const __m128i round = _mm_set1_epi32(128);
+    // SSE2 only packs signed, so results are packed from around zero
+    const __m128i bias32 = _mm_set1_epi32(0x8000);
+    const __m128i bias16 = _mm_set1_epi16((short)0x8000);
+
+    size_t i = 0;
+    for (; i + 8 <= len; i += 8) {
+        __m128i va = _mm_loadu_si128((const __m128i *)(a + i));
+        __m128i vb = _mm_loadu_si128((const __m128i *)(b + i));
+
+        // Full 32-bit products from their low and high halves
+        __m128i a_lo16 = _mm_mullo_epi16(va, inverse);
+        __m128i a_hi16 = _mm_mulhi_epu16(va, inverse);
+        __m128i b_lo16 = _mm_mullo_epi16(vb, w);
+        __m128i b_hi16 = _mm_mulhi_epu16(vb, w);
+
+        __m128i lo = _mm_add_epi32(_mm_unpacklo_epi16(a_lo16, a_hi16), _mm_unpacklo_epi16(b_lo16, b_hi16));
+        __m128i hi = _mm_add_epi32(_mm_unpackhi_epi16(a_lo16, a_hi16), _mm_unpackhi_epi16(b_lo16, b_hi16));
+        lo = _mm_sub_epi32(_mm_srli_epi32(_mm_add_epi32(lo, round), 8), bias32);
+        hi = _mm_sub_epi32(_mm_srli_epi32(_mm_add_epi32(hi, round), 8), bias32);
+
+        _mm_storeu_si128((__m128i *)(out + i), _mm_xor_si128(_mm_packs_epi32(lo, hi), bias16));
+    }
+
+    blend_channels16_scalar(a + i, b + i, out + i, len - i, weight);
+#else
+    blend_channels16_scalar(a, b, out, len, weight);
+#endif
+}
+
+
+Interpolator::Interpolator()
+{
+    _stride = 0;
+    _width = 1;
+    _previous_level = 0;
+    _current_level = 0;
+    _previous_at = 0;
+    _current_at = 0;
+    _frames = 0;
+    _settled = false;
+    _clock.start();
+}
+
+
+void Interpolator::push(const StrandView &frame, uint64_t level)
+{
+    int stride = frame.length;
+    int count = frame.count;
+
+    if (stride != _stride || frame.width != _width || _current.size() != stride * count) {
+        // Layout changed, nothing to blend from
+        _stride = stride;
+        _width = frame.width;
+        _current.fill(0, stride * count);
+        _frames = 0;
+    }
+
+    _previous.swap(_current);
+    if (_current.size() != _previous.size()) {
+        _current.resize(_previous.size());
+    }
+
+    uint8_t *current = (uint8_t *)_current.data();
+    for (int i = 0; i < count; i++) {
+        memcpy(current + i * stride, frame.strand(i), stride);
+    }
+
+    _previous_level = _current_level;
+    _current_level = level;
+
+    _previous_at = _current_at;
+    _current_at = _clock.nsecsElapsed();
+    _frames++;
+    _settled = false;
+}
+
+
+bool Interpolator::render(const StrandView &out, uint64_t *level)
+{
+    if (_frames == 0 || _settled) {
+        return false;
+    }
+    if (out.length != _stride || out.width != _width) {
+        return false;
+    }
+
+    int weight = INTERPOLATE_ONE;
+    if (_frames > 1) {
+        qint64 gap = _current_at - _previous_at;
+        qint64 since = _clock.nsecsElapsed() - _current_at;
+        if (since < gap) {
+            weight = since * INTERPOLATE_ONE / gap;
+        }
+    }
+
+    const uint8_t *previous = (const uint8_t *)_previous.constData();
+    const uint8_t *current = (const uint8_t *)_current.constData();
+
+    for (int i = 0; i < out.count; i++) {
+        if (weight == INTERPOLATE_ONE) {
+            memcpy(out.strand(i), current + i * _stride, _stride);
+        } else if (_width == 2) {
+            blend_channels16((const uint16_t *)(previous + i * _stride), (const uint16_t *)(current + i * _stride),
+                             (uint16_t *)out.strand(i), _stride / 2, weight);
+        } else {
+            blend_channels(previous + i * _stride, current + i * _stride, out.strand(i), _stride, weight);
+        }
+    }
+
+    *level = (_previous_level * (INTERPOLATE_ONE - weight) + _current_level * weight) / INTERPOLATE_ONE;
+
+    _settled = (weight == INTERPOLATE_ONE);
+    return true;
+}
+
+
+void Interpolator::reserve(int bytes)
+{
+    _previous.reserve(bytes);
+    _current.reserve(bytes);
+}
@@ -0,0 +1,89 @@
+// FireNode
+// Copyright (c) 2013 Jon Evans
+// http://craftyjon.com/projects/openlights/firenode
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+
+#ifndef _INTERPOLATE_H
+#define _INTERPOLATE_H
+
+#include "portability.h"
+#include "strand_store.h"
+
+#include <cstddef>
+
+#include <QtCore/QByteArray>
+#include <QtCore/QElapsedTimer>
+
+
+// Blend weights are out of this, so a weight of INTERPOLATE_ONE is the newer frame
+#define INTERPOLATE_ONE 256
+
+// The timer counts whole milliseconds, so anything faster would fire continuously
+#define INTERPOLATE_MAX_FPS 1000
+
+
+//! Linear blend of two channel buffers: out = (a * (256 - weight) + b * weight) / 256.
+//! Uses SSE2 where available.
+void blend_channels(const uint8_t *a, const uint8_t *b, uint8_t *out, size_t len, int weight);
+//! Plain C++ version producing the same output.
+void blend_channels_scalar(const uint8_t *a, const uint8_t *b, uint8_t *out, size_t len, int weight);
+//! The same blend of 16-bit channels.  Uses SSE2 where available.
+void blend_channels16(const uint16_t *a, const uint16_t *b, uint16_t *out, size_t len, int weight);
+void blend_channels16_scalar(const uint16_t *a, const uint16_t *b, uint16_t *out, size_t len, int weight);
+
+
+//! Synthesizes frames between the last two received ones, so the LEDs can
+//! refresh faster than the network sends.
+//!
+//! Output runs one received frame behind: at a time t after frame N arrived
+//! it shows frame N-1 blended towards N by t over the gap between N-1 and N.
+//! Once it reaches frame N it holds it until the next one arrives.
+class Interpolator
+{
+public:
+    Interpolator();
+
+    //! Takes a copy of a newly received frame and its power level (src/power.h).
+    //! 16-bit frames are blended at 16 bits.
+    void push(const StrandView &frame, uint64_t level);
+    //! Writes the frame for now into out, and its level, blended like the
+    //! channels.  Returns false if there is nothing new to show since the
+    //! last call, or out is not laid out like the last frame pushed.
+    bool render(const StrandView &out, uint64_t *level);
+    //! Preallocates for frames of up to bytes (length times count).
+    void reserve(int bytes);
+
+private:
+    QByteArray _previous;
+    QByteArray _current;
+    uint64_t _previous_level;
+    uint64_t _current_level;
+    int _stride;
+    int _width;
+
+    QElapsedTimer _clock;
+    qint64 _previous_at;
+    qint64 _current_at;
+    int _frames;
+    bool _settled;
+};
+
+#endif
@@ -0,0 +1,254 @@
+// FireNode
+// Copyright (c) 2013 Jon Evans
+// http://craftyjon.com/projects/openlights/firenode
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+
+#include "jitter_buffer.h"
+#include "clock_sync.h"
+#include "alloc_tracker.h"
+
+#include <cmath>
+#include <cstring>
+
+#include <QtCore/QDebug>
+
+
+static inline qint64 now_ns()
+{
+    return monotonic_us() * 1000;
+}
+
+
+JitterBuffer::JitterBuffer(int target_ms)
+{
+    _target_ns = (qint64)target_ms * 1000000;
+    _frames.resize(JITTER_BUFFER_MAX_FRAMES);
+    _present_at.resize(JITTER_BUFFER_MAX_FRAMES);
+    _level.resize(JITTER_BUFFER_MAX_FRAMES);
+    _head = 0;
+    _count = 0;
+    _stride = 0;
+    _width = 1;
+
+    _last_arrival = -1;
+    _period = 0;
+    _jitter = 0;
+
+    _playing = false;
+    _next_release = 0;
+
+    _released = 0;
+    _underruns = 0;
+    _dropped = 0;
+    _depth_sum = 0;
+    _depth_min = JITTER_BUFFER_MAX_FRAMES;
+    _depth_max = 0;
+    _presented = 0;
+    _present_error_sum = 0;
+    _present_error_max = 0;
+}
+
+
+qint64 JitterBuffer::delay_ns() const
+{
+    qint64 adaptive = (qint64)(_jitter * JITTER_BUFFER_JITTER_FACTOR);
+    return (adaptive > _target_ns) ? adaptive : _target_ns;
+}
+
+
+qint64 JitterBuffer::period_ns() const
+{
+    // Until we have seen two frames, just wait out the delay again
+    return (_period > 0) ? (qint64)_period : delay_ns();
+}
+
+
+void JitterBuffer::push(const StrandView &frame, uint64_t level, qint64 present_us)
+{
+    qint64 now = now_ns();
+
+    // Running estimates of the source period and the jitter around it, as in RFC 3550
+    if (_last_arrival >= 0) {
+        double delta = now - _last_arrival;
+        if (_period == 0) {
+            _period = delta;
+        } else {
+            _jitter += (fabs(delta - _period) - _jitter) / 16;
+            _period += (delta - _period) / 16;
+        }
+    }
+    _last_arrival = now;
+
+    int stride = frame.length;
+    int count = frame.count;
+    if (stride != _stride || frame.width != _width) {
+        // Layout changed, drop whatever was queued in the old one
+        _stride = stride;
+        _width = frame.width;
+        _count = 0;
+        _playing = false;
+    }
+
+    if (_count == JITTER_BUFFER_MAX_FRAMES) {
+        _head = (_head + 1) % JITTER_BUFFER_MAX_FRAMES;
+        _count--;
+        _dropped++;
+    }
+
+    int slot = (_head + _count) % JITTER_BUFFER_MAX_FRAMES;
+    _present_at[slot] = (present_us >= 0) ? present_us * 1000 + _target_ns : -1;
+    _level[slot] = level;
+
+    QByteArray &queued = _frames[slot];
+    if (queued.size() != stride * count) {
+        queued.resize(stride * count);
+    }
+
+    uint8_t *data = (uint8_t *)queued.data();
+    for (int i = 0; i < count; i++) {
+        memcpy(data + i * stride, frame.strand(i), stride);
+    }
+    _count++;
+
+    if (_present_at[slot] >= 0) {
+        // Timestamped frames do not use the cadence
+        _playing = false;
+    } else if (!_playing) {
+        _playing = true;
+        _next_release = now + delay_ns();
+    }
+}
+
+
+bool JitterBuffer::pop(const StrandView &out, uint64_t *level)
+{
+    qint64 now = now_ns();
+
+    // out is laid out for frames not pushed yet, wait for those
+    if (_count > 0 && (out.length != _stride || out.width != _width)) {
+        return false;
+    }
+
+    if (_count > 0 && _present_at[_head] >= 0) {
+        if (now < _present_at[_head]) {
+            return false;
+        }
+
+        // Several already due (we stalled, or the sender bunched them up): show the newest
+        while (_count > 1) {
+            qint64 next = _present_at[(_head + 1) % JITTER_BUFFER_MAX_FRAMES];
+            if (next < 0 || next > now) {
+                break;
+            }
+            _head = (_head + 1) % JITTER_BUFFER_MAX_FRAMES;
+            _count--;
+            _dropped++;
+        }
+
+        qint64 error = now - _present_at[_head];
+        _presented++;
+        _present_error_sum += error;
+        _present_error_max = (error > _present_error_max) ? error : _present_error_max;
+
+        release(out, level);
+        return true;
+    }
+
+    if (!_playing || now < _next_release) {
+        return false;
+    }
+
+    if (_count == 0) {
+        // Start over once the next frame has had a full delay to arrive
+        _underruns++;
+        _playing = false;
+        return false;
+    }
+
+    // More queued than the delay needs: the source got ahead of us or the jitter settled
+    int wanted = delay_ns() / period_ns() + 1;
+    while (_count > wanted + 1) {
+        _head = (_head + 1) % JITTER_BUFFER_MAX_FRAMES;
+        _count--;
+        _dropped++;
+    }
+
+    release(out, level);
+
+    // Steady cadence, unless we fell a whole period behind (e.g. a stalled event loop)
+    _next_release += period_ns();
+    if (_next_release < now - period_ns()) {
+        _next_release = now;
+    }
+
+    return true;
+}
+
+
+void JitterBuffer::release(const StrandView &out, uint64_t *level)
+{
+    _depth_sum += _count;
+    _depth_min = (_count < _depth_min) ? _count : _depth_min;
+    _depth_max = (_count > _depth_max) ? _count : _depth_max;
+
+    const uint8_t *data = (const uint8_t *)_frames[_head].constData();
+    for (int i = 0; i < out.count; i++) {
+        memcpy(out.strand(i), data + i * _stride, _stride);
+    }
+    *level = _level[_head];
+    _head = (_head + 1) % JITTER_BUFFER_MAX_FRAMES;
+    _count--;
+
+    _released++;
+    if (_released % JITTER_BUFFER_STATS_FRAMES == 0) {
+        print_stats();
+    }
+}
+
+
+void JitterBuffer::reserve(int bytes)
+{
+    for (size_t i = 0; i < _frames.size(); i++) {
+        _frames[i].reserve(bytes);
+    }
+}
+
+
+void JitterBuffer::print_stats()
+{
+    IgnoreAllocations ignore;
+    qDebug("Jitter buffer: delay %.1f ms, jitter %.2f ms, period %.2f ms, depth avg %.1f min %d max %d, %d underruns, %d dropped",
+           delay_ns() / 1e6, _jitter / 1e6, _period / 1e6, (double)_depth_sum / JITTER_BUFFER_STATS_FRAMES,
+           _depth_min, _depth_max, _underruns, _dropped);
+    if (_presented > 0) {
+        qDebug("  presented %d frames on their timestamp, late by avg %lld us, max %lld us",
+               _presented, _present_error_sum / _presented / 1000, _present_error_max / 1000);
+    }
+
+    _depth_sum = 0;
+    _depth_min = JITTER_BUFFER_MAX_FRAMES;
+    _depth_max = 0;
+    _underruns = 0;
+    _dropped = 0;
+    _presented = 0;
+    _present_error_sum = 0;
+    _present_error_max = 0;
+}
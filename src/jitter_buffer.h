@@ -0,0 +1,105 @@
+// FireNode
+// Copyright (c) 2013 Jon Evans
+// http://craftyjon.com/projects/openlights/firenode
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+
+#ifndef _JITTER_BUFFER_H
+#define _JITTER_BUFFER_H
+
+#include "portability.h"
+#include "strand_store.h"
+
+#include <vector>
+
+#include <QtCore/QByteArray>
+
+
+#define JITTER_BUFFER_MAX_FRAMES 32
+// Playout delay is at least this many times the measured jitter
+#define JITTER_BUFFER_JITTER_FACTOR 3
+// How often the playout timer checks for a due frame
+#define JITTER_BUFFER_TICK_MS 1
+#define JITTER_BUFFER_STATS_FRAMES 1000
+
+
+//! Smooths out network jitter by delaying playout.
+//!
+//! Received frames are queued, and released one per estimated source frame
+//! period on a steady monotonic cadence, starting one playout delay after the
+//! first frame.  The delay is the configured target, or a multiple of the
+//! measured inter-arrival jitter if that is larger.  If the queue runs dry
+//! (underrun) playout stops and restarts a full delay after the next frame;
+//! if it holds more than the delay calls for, the oldest frames are dropped
+//! to keep latency bounded.
+//!
+//! Frames that carry a presentation time are instead released at that time
+//! plus the configured target, so every node given the same target shows
+//! them together.
+class JitterBuffer
+{
+public:
+    JitterBuffer(int target_ms);
+
+    //! Queues a copy of a newly received frame and its power level
+    //! (src/power.h).  present_us is when to show it on monotonic_us(), or -1.
+    void push(const StrandView &frame, uint64_t level, qint64 present_us = -1);
+    //! Writes the next frame and its level into out if it is due.  out must
+    //! have the count, length and width of the frames pushed since.  Call at
+    //! least every JITTER_BUFFER_TICK_MS.
+    bool pop(const StrandView &out, uint64_t *level);
+    //! Preallocates every slot for frames of up to bytes (length times count).
+    void reserve(int bytes);
+
+private:
+    qint64 delay_ns(void) const;
+    qint64 period_ns(void) const;
+    void release(const StrandView &out, uint64_t *level);
+    void print_stats(void);
+
+    qint64 _target_ns;
+
+    std::vector<QByteArray> _frames;
+    std::vector<qint64> _present_at;
+    std::vector<uint64_t> _level;
+    int _head;
+    int _count;
+    int _stride;
+    int _width;
+
+    qint64 _last_arrival;
+    double _period;
+    double _jitter;
+
+    bool _playing;
+    qint64 _next_release;
+
+    int _released;
+    int _underruns;
+    int _dropped;
+    qint64 _depth_sum;
+    int _depth_min;
+    int _depth_max;
+    int _presented;
+    qint64 _present_error_sum;
+    qint64 _present_error_max;
+};
+
+#endif
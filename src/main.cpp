@@ -40,6 +40,17 @@
 #include "networking.h"
 #include "unpacker.h"
 #include "serial.h"
+#include "usb.h"
+#include "frame_sync.h"
+#include "transpose.h"
+#include "remap.h"
+#include "work_pool.h"
+#include "pipeline.h"
+#include "realtime.h"
+#ifdef Q_OS_LINUX
+#include "tty.h"
+#include "hotplug.h"
+#endif
 
 
 QCoreApplication *pApp;
@@ -56,11 +67,42 @@ void sig_handler(int sig)
 }
 
 
+//! Reads the entry for one kind of thread from the "realtime" section.
+static bool read_realtime_policy(const QJsonObject &section, const char *name, bool prefault, RealtimePolicy *policy)
+{
+    QJsonObject entry = section[name].toObject();
+    QJsonArray cpus = entry["cpus"].toArray();
+    int priority = entry["priority"].toInt(0);
+
+    QList<int> cpu_list;
+    for (int i = 0; i < cpus.size(); i++) {
+        int cpu = cpus[i].toInt(-1);
+        if (cpu < 0 || cpu >= REALTIME_MAX_CPUS) {
+            qWarning("realtime %s: CPUs are numbered from 0 to %d, not %d.", name, REALTIME_MAX_CPUS - 1, cpu);
+            return false;
+        }
+        cpu_list.append(cpu);
+    }
+
+    if (priority < 0 || priority > REALTIME_MAX_PRIORITY) {
+        qWarning("realtime %s: priority must be between 0 and %d, not %d.", name, REALTIME_MAX_PRIORITY, priority);
+        return false;
+    }
+
+    policy->set_cpus(cpu_list);
+    policy->set_priority(priority);
+    policy->set_prefault_stack(prefault);
+    return true;
+}
+
+
 int main(int argc, char** argv)
 {
     QCoreApplication app(argc, argv);
     pApp = &app;
 
+    qRegisterMetaType<quint32>("quint32");
+
     QFile config_file("config.json");
 
     if (!config_file.open(QIODevice::ReadOnly)) {
@@ -74,9 +116,26 @@ int main(int argc, char** argv)
     int udp_port = config_doc.object()["port"].toInt();
     bool listen_all = config_doc.object()["listenAll"].toBool(false);
 
+    bool frame_sync = config_doc.object()["frame-sync"].toBool(false);
+    QString record_path = config_doc.object()["record"].toString();
+    int interpolate_fps = config_doc.object()["interpolate-fps"].toInt(0);
+    int jitter_buffer_ms = config_doc.object()["jitter-buffer-ms"].toInt(0);
+    QString clock_server = config_doc.object()["clock-server"].toString();
+    double power_budget_ma = config_doc.object()["power-budget-ma"].toDouble(0);
+    int packet_pool = config_doc.object()["packet-pool"].toInt(NETWORKING_PACKET_POOL);
+    int assembly_threads = config_doc.object()["assembly-threads"].toInt(0);
+    int pipeline_depth = config_doc.object()["pipeline-depth"].toInt(PIPELINE_DEFAULT_DEPTH);
+    QString ingest_mode = config_doc.object()["ingest-mode"].toString("event-loop");
+    int busy_poll_spin_us = config_doc.object()["busy-poll-spin-us"].toInt(BUSY_POLL_DEFAULT_SPIN_US);
+    int busy_poll_socket_us = config_doc.object()["busy-poll-socket-us"].toInt(0);
+    bool ingest_latency_stats = config_doc.object()["ingest-latency-stats"].toBool(false);
+    QJsonObject realtime = config_doc.object()["realtime"].toObject();
+    bool lock_memory = realtime["lock-memory"].toBool(false);
+    bool prefault = realtime["prefault"].toBool(false);
+
     QJsonArray outputs = config_doc.object()["outputs"].toArray();
 
-    Serial* serials[MAX_OUTPUTS];
+    Output* serials[MAX_OUTPUTS];
     Unpacker* unpackers[MAX_OUTPUTS];
 
     int num_serials = 0;
@@ -86,26 +145,346 @@ int main(int argc, char** argv)
         return 2;
     }
 
+    if (packet_pool < 1) {
+        qWarning("packet-pool must be at least 1, not %d.", packet_pool);
+        return 2;
+    }
+
+    // Receiving covers the network thread and the main thread that unpacks
+    // strands; writing covers the tty and usb threads
+    RealtimePolicy ingest_policy("ingest");
+    RealtimePolicy assembly_policy("assembly");
+    RealtimePolicy writer_policy("writer");
+    RealtimePolicy busy_poll_policy("busy-poll");
+    if (!read_realtime_policy(realtime, "ingest", prefault, &ingest_policy) ||
+        !read_realtime_policy(realtime, "busy-poll", prefault, &busy_poll_policy) ||
+        !read_realtime_policy(realtime, "assembly", prefault, &assembly_policy) ||
+        !read_realtime_policy(realtime, "writer", prefault, &writer_policy)) {
+        return 2;
+    }
+
+    // Before any frame buffer is allocated, so they can all be prefaulted once reserved
+    if (prefault) {
+        realtime_keep_heap();
+    }
+
+    if (ingest_mode != "event-loop" && ingest_mode != "busy-poll") {
+        qWarning("ingest-mode must be event-loop or busy-poll, not %s.", qPrintable(ingest_mode));
+        return 2;
+    }
+    if (busy_poll_spin_us < 0 || busy_poll_socket_us < 0) {
+        qWarning("busy-poll-spin-us and busy-poll-socket-us cannot be negative.");
+        return 2;
+    }
+
     Networking net(udp_port, listen_all);
+    net.set_packet_pool(packet_pool);
+    net.set_latency_stats(ingest_latency_stats);
+    if (ingest_mode == "busy-poll" && !net.set_busy_poll(busy_poll_spin_us, busy_poll_socket_us, &busy_poll_policy)) {
+        qWarning("Receiving in the event loop instead.");
+    }
+    if (!record_path.isEmpty()) {
+        net.set_recording(record_path);
+    }
+
+    // Frames that carry a presentation timestamp are shown at that time on the sender's clock
+    ClockSync *clock_sync = NULL;
+    if (!clock_server.isEmpty()) {
+        clock_sync = new ClockSync();
+        if (!net.set_clock_sync(clock_sync, clock_server)) {
+            return 2;
+        }
+    }
+
+    if (interpolate_fps < 0 || interpolate_fps > INTERPOLATE_MAX_FPS) {
+        qWarning("interpolate-fps must be 0 (off) to %d, not %d.", INTERPOLATE_MAX_FPS, interpolate_fps);
+        return 2;
+    }
+
     QTimer *serial_timer = new QTimer(&app);
     serial_timer->setInterval(1.0 / 25.0);
 
+    // Synthesizes frames between received ones at the LED refresh rate
+    QTimer *interpolate_timer = NULL;
+    if (interpolate_fps > 0) {
+        interpolate_timer = new QTimer(&app);
+        interpolate_timer->setTimerType(Qt::PreciseTimer);
+        interpolate_timer->setInterval(qRound(1000.0 / interpolate_fps));
+    }
+
+    // Releases buffered frames on their own cadence instead of as they arrive
+    QTimer *playout_timer = NULL;
+    if (jitter_buffer_ms > 0 || clock_sync != NULL) {
+        playout_timer = new QTimer(&app);
+        playout_timer->setTimerType(Qt::PreciseTimer);
+        playout_timer->setInterval(JITTER_BUFFER_TICK_MS);
+    }
+
+    if (assembly_threads < 0) {
+        qWarning("assembly-threads must be 0 (one per core) or more, not %d.", assembly_threads);
+        return 2;
+    }
+
+    if (pipeline_depth < 1 || pipeline_depth > PIPELINE_MAX_DEPTH) {
+        qWarning("pipeline-depth must be between 1 and %d, not %d.", PIPELINE_MAX_DEPTH, pipeline_depth);
+        return 2;
+    }
+
+    // Assembly runs off the main thread so it overlaps receiving the next frame,
+    // and outputs assemble side by side when there are cores to spare
+    if (assembly_threads == 0) {
+        assembly_threads = qMax(1, qMin(QThread::idealThreadCount(), (int)outputs.size()));
+    }
+    WorkPool *assembly_pool = new WorkPool(assembly_threads, &assembly_policy);
+    if (!assembly_pool->started()) {
+        return 1;
+    }
+
+    // Strand buffers of every output, in one block
+    StrandStore *strand_store = new StrandStore();
+
+    // Shared by every output, on top of their own budgets
+    PowerBudget *global_power = (power_budget_ma > 0) ? new PowerBudget(power_budget_ma, outputs.size()) : NULL;
+
+    FrameSync *sync = frame_sync ? new FrameSync(FRAME_SYNC_MARGIN_US) : NULL;
+    SyncGroup *serial_sync = NULL;
+
+#ifdef Q_OS_LINUX
+    TtyWriter *tty_writer = NULL;
+    Hotplug *hotplug = NULL;
+#endif
+
     for (int output_index = 0; output_index < outputs.size(); output_index++) {
         QJsonObject output_obj = outputs[output_index].toObject();
         //qDebug() << output_index << output_obj;
 
         QString serial_port = output_obj["port"].toString();
+        QString serial_number = output_obj["serial-number"].toString();
         int first_strand = output_obj["first-strand"].toInt();
         int last_strand = output_obj["last-strand"].toInt();
-
-        serials[output_index] = new Serial(serial_port);
-        unpackers[output_index] = new Unpacker(first_strand, last_strand);
+        int protocol = output_obj["protocol"].toInt(1);
+        int lanes = output_obj["lanes"].toInt(LANES_DEFAULT);
+        QJsonArray strand_lengths = output_obj["strand-lengths"].toArray();
+        QJsonObject remap = output_obj["remap"].toObject();
+        QString color_order_name = output_obj["color-order"].toString(COLOR_ORDER_DEFAULT);
+        bool partial_updates = output_obj["partial-updates"].toBool(false);
+        int keyframe_interval = output_obj["keyframe-interval"].toInt(PARTIAL_DEFAULT_KEYFRAME_INTERVAL);
+        bool compress = output_obj["compress"].toBool(false);
+        QString bit_depth = output_obj["bit-depth"].toString("888");
+        bool dither = output_obj["dither"].toBool(true);
+        double output_power_ma = output_obj["power-budget-ma"].toDouble(0);
+        double ma_per_channel = output_obj["ma-per-channel"].toDouble(POWER_DEFAULT_MA_PER_CHANNEL);
+        double gamma = output_obj["gamma"].toDouble(1.0);
+
+        if (protocol != 1 && protocol != 2) {
+            qWarning("Output %d: unknown protocol version %d.", output_index, protocol);
+            return 2;
+        }
+
+        if (lanes != 8 && lanes != 16 && lanes != 32) {
+            qWarning("Output %d: lanes must be 8, 16 or 32, not %d.", output_index, lanes);
+            return 2;
+        }
+        if (last_strand - first_strand + 1 > lanes) {
+            qWarning("Output %d: %d strands do not fit in %d lanes, the rest are ignored.",
+                     output_index, last_strand - first_strand + 1, lanes);
+        }
+
+        QString backend = output_obj["backend"].toString();
+
+        if (backend == "tty") {
+#ifdef Q_OS_LINUX
+            if (tty_writer == NULL) {
+                tty_writer = new TtyWriter();
+                realtime_prepare_thread(tty_writer, &writer_policy);
+                if (sync != NULL) {
+                    tty_writer->set_frame_sync(sync);
+                }
+            }
+            serials[output_index] = new TtySerial(serial_port, tty_writer, output_index);
+#else
+            qWarning("The tty backend is only available on Linux, using QSerialPort instead.");
+            backend = "";
+#endif
+        } else if (backend == "usb") {
+#ifdef USE_LIBUSB
+            serials[output_index] = new USBStrandController(new LibusbTransport(), &writer_policy);
+#else
+            qWarning("FireNode was built without libusb, cannot use the usb backend.");
+            return 3;
+#endif
+        } else if (backend == "usb-loopback") {
+            serials[output_index] = new USBStrandController(new LoopbackTransport(), &writer_policy);
+        } else {
+            backend = "";
+        }
+
+        if (backend.isEmpty()) {
+            Serial *serial = new Serial(serial_port);
+
+            if (sync != NULL) {
+                if (serial_sync == NULL) {
+                    serial_sync = new SyncGroup(sync);
+                }
+                serial->set_frame_sync(true);
+                serial_sync->add_output(serial, output_index);
+            }
+
+            serials[output_index] = serial;
+        } else if (sync != NULL && backend.startsWith("usb")) {
+            qWarning("Output %d: frame sync is not supported by the usb backend.", output_index);
+        }
+
+        if (!serial_number.isEmpty()) {
+#ifdef Q_OS_LINUX
+            if (hotplug == NULL) {
+                hotplug = new Hotplug();
+            }
+            hotplug->add_output(serial_number, serials[output_index]);
+#else
+            qWarning("Output %d: matching by serial-number needs hotplug support, which is Linux only.", output_index);
+#endif
+        }
+
+        unpackers[output_index] = new Unpacker(first_strand, last_strand, strand_store);
+        unpackers[output_index]->set_protocol(protocol);
+        unpackers[output_index]->set_lanes(lanes);
+
+        const ColorOrder *color_order = find_color_order(color_order_name);
+        if (color_order == NULL) {
+            qWarning("Output %d: unknown color order %s.", output_index, qPrintable(color_order_name));
+            return 2;
+        }
+        unpackers[output_index]->set_color_order(color_order);
+
+        if (gamma <= 0) {
+            qWarning("Output %d: gamma must be positive, not %g.", output_index, gamma);
+            return 2;
+        }
+        unpackers[output_index]->set_gamma(gamma);
+
+        if (!strand_lengths.isEmpty()) {
+            if (strand_lengths.size() != last_strand - first_strand + 1) {
+                qWarning("Output %d: strand-lengths needs one entry per strand from %d to %d.",
+                         output_index, first_strand, last_strand);
+                return 2;
+            }
+
+            QList<int> pixels;
+            for (int i = 0; i < strand_lengths.size(); i++) {
+                int length = strand_lengths[i].toInt();
+                if (length <= 0 || length > MAX_STRAND_PIXELS) {
+                    qWarning("Output %d: strand-lengths entries must be 1 to %d pixels, not %d (strand %d).",
+                             output_index, MAX_STRAND_PIXELS, length, first_strand + i);
+                    return 2;
+                }
+                pixels.append(length);
+            }
+            unpackers[output_index]->set_strand_lengths(pixels);
+        }
+
+        if (!remap.isEmpty()) {
+            // Sized for the longest declared strand unless given
+            int layout_pixels = remap["pixels"].toInt(0);
+            for (int i = 0; layout_pixels == 0 && i < strand_lengths.size(); i++) {
+                layout_pixels = qMax(layout_pixels, strand_lengths[i].toInt());
+            }
+
+            QString remap_type = remap["type"].toString();
+            std::vector<int32_t> layout;
+
+            if (remap_type == "file") {
+                if (!remap_from_file(remap["path"].toString(), &layout)) {
+                    return 2;
+                }
+            } else if (layout_pixels <= 0) {
+                qWarning("Output %d: remap needs \"pixels\" or strand-lengths.", output_index);
+                return 2;
+            } else if (remap_type == "serpentine") {
+                layout = remap_serpentine(layout_pixels, qMax(1, remap["width"].toInt(layout_pixels)));
+            } else if (remap_type == "reversed") {
+                layout = remap_reversed(layout_pixels);
+            } else if (remap_type == "offset") {
+                layout = remap_offset(layout_pixels, remap["offset"].toInt());
+            } else {
+                qWarning("Output %d: unknown remap type %s.", output_index, qPrintable(remap_type));
+                return 2;
+            }
+
+            unpackers[output_index]->set_remap(layout);
+        }
+
+        if (partial_updates) {
+            if (protocol == 2) {
+                unpackers[output_index]->set_partial_updates(keyframe_interval);
+            } else {
+                qWarning("Output %d: partial updates need protocol 2, sending full frames.", output_index);
+            }
+        }
+
+        if (compress) {
+            if (protocol == 2) {
+                unpackers[output_index]->set_compression(true);
+            } else {
+                qWarning("Output %d: compression needs protocol 2, sending uncompressed frames.", output_index);
+            }
+        }
+
+        if (bit_depth != "888") {
+            if (protocol != 2) {
+                qWarning("Output %d: reduced bit depth needs protocol 2, sending 8 bits per channel.", output_index);
+            } else if (bit_depth == "565") {
+                unpackers[output_index]->set_bit_depth(PROTOCOL_FORMAT_565, dither);
+            } else if (bit_depth == "444") {
+                unpackers[output_index]->set_bit_depth(PROTOCOL_FORMAT_444, dither);
+            } else if (bit_depth == "adaptive") {
+                unpackers[output_index]->set_adaptive_bit_depth(dither);
+            } else {
+                qWarning("Output %d: unknown bit depth %s.", output_index, qPrintable(bit_depth));
+                return 2;
+            }
+        }
+
+        unpackers[output_index]->set_power_budget(output_power_ma, ma_per_channel);
+        if (global_power != NULL) {
+            unpackers[output_index]->set_global_power_budget(global_power, output_index);
+        }
+        unpackers[output_index]->set_assembly_pool(assembly_pool);
+        unpackers[output_index]->set_pipeline_depth(pipeline_depth, output_index);
+        serials[output_index]->set_pipeline_depth(pipeline_depth, output_index);
         num_serials++;
 
         QObject::connect(&net, SIGNAL(data_ready(QByteArray)), unpackers[output_index], SLOT(unpack_data(QByteArray)));
-        QObject::connect(unpackers[output_index], SIGNAL(frame_end()), unpackers[output_index], SLOT(assemble_data()));
-        QObject::connect(unpackers[output_index], SIGNAL(data_ready(QByteArray*)), serials[output_index], SLOT(update_data(QByteArray*)));
+        if (interpolate_timer != NULL || playout_timer != NULL) {
+            QObject::connect(unpackers[output_index], SIGNAL(frame_end()), unpackers[output_index], SLOT(frame_received()));
+        } else {
+            QObject::connect(unpackers[output_index], SIGNAL(frame_end()), unpackers[output_index], SLOT(assemble_data()));
+        }
+        if (playout_timer != NULL) {
+            unpackers[output_index]->set_jitter_buffer(jitter_buffer_ms);
+            if (clock_sync != NULL) {
+                unpackers[output_index]->set_clock_sync(clock_sync);
+            }
+            QObject::connect(playout_timer, SIGNAL(timeout()), unpackers[output_index], SLOT(playout_frame()));
+        }
+        if (interpolate_timer != NULL) {
+            unpackers[output_index]->set_interpolation(true);
+            QObject::connect(interpolate_timer, SIGNAL(timeout()), unpackers[output_index], SLOT(interpolate_frame()));
+        }
+
+        // Everything a frame passes through is allocated now rather than on the first frames
+        unpackers[output_index]->reserve_frames();
+        serials[output_index]->reserve(unpackers[output_index]->max_payload_size());
+
+        QObject::connect(unpackers[output_index], SIGNAL(data_ready(const OutputFrame*)), serials[output_index], SLOT(update_data(const OutputFrame*)), Qt::DirectConnection);
         QObject::connect(serial_timer, SIGNAL(timeout()), serials[output_index], SLOT(write_data()));
+        QObject::connect(serials[output_index], SIGNAL(frame_acked(quint32)), unpackers[output_index], SLOT(frame_acked(quint32)));
+        QObject::connect(serials[output_index], SIGNAL(frame_rejected()), unpackers[output_index], SLOT(frame_rejected()));
+    }
+
+    // Connected last so it runs after every output has written its frame for this tick
+    if (serial_sync != NULL) {
+        QObject::connect(serial_timer, SIGNAL(timeout()), serial_sync, SLOT(commit()));
     }
 
     signal(SIGINT, sig_handler);
@@ -117,18 +496,52 @@ int main(int argc, char** argv)
     //stats_timer.start((unsigned int)(1000.0 * STATS_TIME));
 
     QThread netThread;
+    realtime_prepare_thread(&netThread, &ingest_policy);
     QObject::connect(&app, SIGNAL(aboutToQuit()), &net, SLOT(stop()));
     QObject::connect(&app, SIGNAL(aboutToQuit()), &netThread, SLOT(quit()));
 
-    netThread.start();
+    if (!realtime_start_thread(&netThread, "network")) {
+        return 1;
+    }
     net.moveToThread(&netThread);
-    net.start();
+    if (!net.start()) {
+        return 1;
+    }
+
+#ifdef Q_OS_LINUX
+    if (hotplug != NULL) {
+        hotplug->start();
+    }
+
+    if (tty_writer != NULL) {
+        QObject::connect(&app, SIGNAL(aboutToQuit()), tty_writer, SLOT(stop()));
+        if (!realtime_start_thread(tty_writer, "tty writer")) {
+            return 1;
+        }
+    }
+#endif
+
+    // Every buffer a frame passes through is reserved, and every thread with
+    // its bounded stack is running, so locking now cannot starve thread creation
+    if (prefault) {
+        realtime_prefault_heap();
+    }
+    if (lock_memory) {
+        realtime_lock_memory();
+    }
 
     //QThread timer_thread;
     //serial_timer->moveToThread(&timer_thread);
     serial_timer->start();
     //timer_thread.start();
 
+    if (interpolate_timer != NULL) {
+        interpolate_timer->start();
+    }
+    if (playout_timer != NULL) {
+        playout_timer->start();
+    }
+
 #ifdef USE_ZMQ
     QTimer *net_timer = new QTimer(&app);
     net_timer->setInterval(1.0);
@@ -138,15 +551,33 @@ int main(int argc, char** argv)
 
     //QObject::connect(&stats_timer, SIGNAL(timeout()), ser, SLOT(print_stats()));
 
+    // Last, so threads started from here do not inherit it
+    ingest_policy.apply();
+
     app.exec();
 
     serial_timer->deleteLater();
+    if (interpolate_timer != NULL) {
+        interpolate_timer->deleteLater();
+    }
+    if (playout_timer != NULL) {
+        playout_timer->deleteLater();
+    }
+
+    // Nothing may be left assembling when the outputs go
+    assembly_pool->wait_idle();
+    delete assembly_pool;
 
     for (int serial_index = 0; serial_index < num_serials; serial_index++) {
         serials[serial_index]->deleteLater();
         unpackers[serial_index]->deleteLater();
     }
 
+#ifdef Q_OS_LINUX
+    delete hotplug;
+    delete tty_writer;
+#endif
+
     std::cout << "Bye" << std::endl;
 
     return 0;
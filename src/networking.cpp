@@ -24,7 +24,19 @@
 //#include "zmq.h"
 
 Networking::Networking(int port, bool listen_all)
+    : _alloc_check("networking")
 {
+    _recorder = NULL;
+    _clock_sync = NULL;
+    _clock_server_port = 0;
+    _clock_timer = NULL;
+    _pool.resize(NETWORKING_PACKET_POOL);
+    _pool_next = 0;
+#ifdef Q_OS_LINUX
+    _poller = NULL;
+    _latency = NULL;
+#endif
+
 #ifdef USE_ZMQ
     Q_UNUSED(port);
     running = false;
@@ -47,16 +59,129 @@ Networking::Networking(int port, bool listen_all)
 #endif
 }
 
-void Networking::start()
+void Networking::set_recording(const QString path)
+{
+    delete _recorder;
+    _recorder = new Recorder(path);
+
+    if (_recorder->is_open()) {
+        qDebug() << "Recording to" << path;
+    }
+}
+
+bool Networking::set_clock_sync(ClockSync *clock_sync, const QString server)
+{
+    int colon = server.lastIndexOf(':');
+    if (colon < 0 || !_clock_server.setAddress(server.left(colon))) {
+        qWarning() << "Clock server must be an address:port, not" << server;
+        return false;
+    }
+    _clock_server_port = server.mid(colon + 1).toUShort();
+    _clock_sync = clock_sync;
+
+    // Keeps running when moved to the network thread
+    _clock_timer = new QTimer(this);
+    _clock_timer->setInterval(CLOCK_SYNC_INTERVAL_MS);
+    connect(_clock_timer, SIGNAL(timeout()), this, SLOT(request_clock()));
+    _clock_timer->start();
+
+    qDebug() << "Syncing clock with" << server;
+    return true;
+}
+
+void Networking::set_packet_pool(int packets)
+{
+    _pool.assign(packets, QByteArray());
+    _pool_next = 0;
+
+    for (int i = 0; i < packets; i++) {
+        _pool[i].reserve(MAX_PACKET_SIZE);
+    }
+}
+
+bool Networking::set_busy_poll(int spin_us, int socket_busy_poll_us, RealtimePolicy *policy)
+{
+#if defined(Q_OS_LINUX) && !defined(USE_ZMQ)
+    // The poller reads the socket from now on, the event loop only sends on it
+    disconnect(_socket, SIGNAL(readyRead()), this, SLOT(read_pending_packets()));
+
+    _poller = new BusyPoller(this, _socket->socketDescriptor());
+    _poller->set_spin_us(spin_us);
+    _poller->set_socket_busy_poll(socket_busy_poll_us);
+    _poller->set_latency_stats(_latency != NULL);
+    realtime_prepare_thread(_poller, policy);
+    return true;
+#else
+    Q_UNUSED(spin_us);
+    Q_UNUSED(socket_busy_poll_us);
+    Q_UNUSED(policy);
+    qWarning("Busy-poll ingest is only available on Linux.");
+    return false;
+#endif
+}
+
+void Networking::set_latency_stats(bool enabled)
+{
+#ifdef Q_OS_LINUX
+    delete _latency;
+    _latency = enabled ? new IngestLatency("qt event loop") : NULL;
+    if (_poller) {
+        _poller->set_latency_stats(enabled);
+    }
+#else
+    if (enabled) {
+        qWarning("Ingest latency stats are only available on Linux.");
+    }
+#endif
+}
+
+QByteArray &Networking::packet_buffer(int size)
+{
+    TrackAllocations tracking;
+    QByteArray &packet = _pool[_pool_next];
+
+    // Still queued to an unpacker: writing to it would detach, so let it go
+    if (!packet.isDetached()) {
+        packet = QByteArray();
+    }
+    if (packet.capacity() < size) {
+        packet.reserve(qMax(size, MAX_PACKET_SIZE));
+    }
+    packet.resize(size);
+
+    return packet;
+}
+
+void Networking::request_clock()
+{
+#ifndef USE_ZMQ
+    QByteArray request;
+    _clock_sync->make_request(&request);
+    _socket->writeDatagram(request, _clock_server, _clock_server_port);
+#endif
+}
+
+bool Networking::start()
 {
     running = true;
+#ifdef Q_OS_LINUX
+    if (_poller && !realtime_start_thread(_poller, "busy-poll")) {
+        return false;
+    }
+#endif
     emit run();
+    return true;
 }
 
 void Networking::stop()
 {
     qDebug() << "quit!";
     running = false;
+#ifdef Q_OS_LINUX
+    if (_poller) {
+        _poller->stop();
+    }
+#endif
 }
 
 void Networking::run()
@@ -68,12 +193,38 @@ void Networking::read_pending_packets()
 {
     while (_socket->hasPendingDatagrams())
     {
-        QByteArray dgram;
-        dgram.resize(_socket->pendingDatagramSize());
-        _socket->readDatagram(dgram.data(), dgram.size());
+        int size = _socket->pendingDatagramSize();
+        _socket->readDatagram(packet_buffer(size).data(), size);
+#ifdef Q_OS_LINUX
+        if (_latency) {
+            _latency->sample(_socket->socketDescriptor());
+        }
+#endif
+        packet_received(size);
+    }
+}
 
-        emit data_ready(dgram);
+void Networking::packet_received(int size)
+{
+    // Queuing the signal to the unpackers allocates in Qt, receiving must not
+    {
+        TrackAllocations tracking;
+        _pool[_pool_next].resize(size);
     }
+    const QByteArray &dgram = _pool[_pool_next];
+    _pool_next = (_pool_next + 1) % _pool.size();
+    _alloc_check.frame_done();
+
+    if (_clock_sync && dgram.size() > 0 && dgram.at(0) == CLOCK_SYNC_REPLY) {
+        _clock_sync->handle_reply(dgram);
+        return;
+    }
+
+    if (_recorder) {
+        _recorder->write(dgram);
+    }
+
+    emit data_ready(dgram);
 }
 
 void Networking::get_data()
@@ -109,6 +260,16 @@ void Networking::get_data()
 
 Networking::~Networking()
 {
+#ifdef Q_OS_LINUX
+    if (_poller) {
+        _poller->stop();
+        _poller->wait();
+        delete _poller;
+    }
+    delete _latency;
+#endif
+    delete _recorder;
+
 #ifdef USE_ZMQ
     zmq_close(subscriber);
     zmq_ctx_destroy(context);
@@ -28,7 +28,18 @@
 #include <QtCore/QTimer>
 #include <QtNetwork/QUdpSocket>
 
+#include "recording.h"
+#include "clock_sync.h"
+#include "alloc_tracker.h"
+#include "realtime.h"
+
+#include <vector>
+
 #define MAX_PACKET_SIZE 16384
+// Datagrams that can be queued to the unpackers before one is reallocated
+#define NETWORKING_PACKET_POOL 256
+// How long the busy-poll thread spins after the last datagram before it blocks
+#define BUSY_POLL_DEFAULT_SPIN_US 50000
 
 //#define USE_ZMQ
 
@@ -36,6 +47,10 @@
 #include "zmq.h"
 #endif
 
+#ifdef Q_OS_LINUX
+#include "busy_poll.h"
+#endif
+
 class Networking : public QObject
 {
     Q_OBJECT
@@ -47,20 +62,37 @@ public:
     bool open(void);
     bool close(void);
 
+    void set_recording(const QString path);
+    bool set_clock_sync(ClockSync *clock_sync, const QString server);
+    //! Receives into packets buffers of MAX_PACKET_SIZE, allocated now and reused in turn.
+    void set_packet_pool(int packets);
+    //! Receives on a spinning thread of its own instead of the event loop
+    //! (see src/busy_poll.h), which applies policy as it starts.  Linux only.
+    bool set_busy_poll(int spin_us, int socket_busy_poll_us, RealtimePolicy *policy);
+    //! Reports how long datagrams wait before they are read.
+    void set_latency_stats(bool enabled);
+
+    //! The pool buffer the next datagram goes into, sized for size bytes.
+    QByteArray &packet_buffer(int size);
+    //! Passes on the size bytes just read into packet_buffer().  Called by
+    //! whichever thread receives.
+    void packet_received(int size);
+
 public slots:
-    void start(void);
+    //! False if the busy-poll thread could not be started.
+    bool start(void);
     void run(void);
     void stop(void);
     void get_data(void);
 
 private slots:
     void read_pending_packets(void);
+    void request_clock(void);
 
 signals:
     void data_ready(QByteArray data);
 
 private:
-
     void *context;
     void *subscriber;
     int port;
@@ -68,6 +100,21 @@ private:
 
     QTimer *_timer;
     QUdpSocket *_socket;
+    Recorder *_recorder;
+
+    ClockSync *_clock_sync;
+    QHostAddress _clock_server;
+    quint16 _clock_server_port;
+    QTimer *_clock_timer;
+
+    std::vector<QByteArray> _pool;
+    size_t _pool_next;
+    AllocationCheck _alloc_check;
+
+#ifdef Q_OS_LINUX
+    BusyPoller *_poller;
+    IngestLatency *_latency;
+#endif
 };
 
 #endif
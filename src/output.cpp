@@ -0,0 +1,66 @@
+// FireNode
+// Copyright (c) 2013 Jon Evans
+// http://craftyjon.com/projects/openlights/firenode
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#include "output.h"
+
+
+void Output::set_pipeline_depth(int frames, int output)
+{
+    _queue.set_depth(frames, output);
+}
+
+
+void Output::reserve(int bytes)
+{
+    _queue.reserve(bytes);
+}
+
+
+void Output::update_data(const OutputFrame *frame)
+{
+    _queue.push(*frame);
+}
+
+
+bool Output::next_frame(FrameBuffer *frame)
+{
+    return _queue.pop(frame);
+}
+
+
+void Output::parse_replies(const char *data, int len)
+{
+    uint8_t kind;
+    uint32_t frame_id;
+
+    for (int i = 0; i < len; i++) {
+        if (!_replies.push(data[i], &kind, &frame_id)) {
+            continue;
+        }
+
+        if (kind == PROTOCOL_REPLY_ACK) {
+            emit frame_acked(frame_id);
+        } else {
+            emit frame_rejected();
+        }
+    }
+}
@@ -0,0 +1,82 @@
+// FireNode
+// Copyright (c) 2013 Jon Evans
+// http://craftyjon.com/projects/openlights/firenode
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#ifndef _OUTPUT_H
+#define _OUTPUT_H
+
+#include "protocol.h"
+#include "frame.h"
+#include "pipeline.h"
+#include "alloc_tracker.h"
+
+#include <QtCore/QObject>
+
+
+//! Common interface for anything that sends assembled frames to a strand controller.
+class Output : public QObject
+{
+    Q_OBJECT
+
+public:
+    virtual ~Output() {}
+
+    //! True while frame sync is holding back the last byte of the current frame.
+    virtual bool holding_frame(void) { return false; }
+    //! Sends the byte held back by frame sync.  Returns false if nothing was held.
+    virtual bool release_frame(void) { return false; }
+
+    //! Frames assembled but not yet written that are kept, past which the
+    //! oldest is dropped.  output numbers the occupancy report.
+    void set_pipeline_depth(int frames, int output);
+    //! Preallocates for payloads of up to bytes so queueing frames never allocates.
+    //! Outputs with buffers of their own reserve those too.
+    virtual void reserve(int bytes);
+    //! Swaps the oldest queued frame into frame, for whichever thread writes.
+    //! Returns false, leaving frame alone, if none is queued.
+    bool next_frame(FrameBuffer *frame);
+
+    //! Hotplug found this output's device at path.  Only hotplug reopens it from now on.
+    virtual void device_added(const QString path) { Q_UNUSED(path); }
+    //! Hotplug saw this output's device go away.
+    virtual void device_removed(void) {}
+
+    //! Feeds bytes read back from the device through the reply parser.
+    void parse_replies(const char *data, int len);
+
+public slots:
+    //! Queues a copy of the next frame to send.  The caller keeps ownership of frame.
+    void update_data(const OutputFrame *frame);
+    //! Sends the oldest queued frame, or the last one again if none is queued.
+    virtual void write_data(void) = 0;
+
+signals:
+    //! The receiver confirmed it applied frame_id (protocol v2).
+    void frame_acked(quint32 frame_id);
+    //! The receiver could not apply a partial frame and needs a full one.
+    void frame_rejected(void);
+
+private:
+    ReplyParser _replies;
+    FrameQueue _queue;
+};
+
+#endif
@@ -0,0 +1,200 @@
+// FireNode
+// Copyright (c) 2013 Jon Evans
+// http://craftyjon.com/projects/openlights/firenode
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#include "partial.h"
+
+#include <cstring>
+
+
+static inline void write_le32(uint8_t *out, uint32_t value)
+{
+    out[0] = value & 0xFF;
+    out[1] = (value >> 8) & 0xFF;
+    out[2] = (value >> 16) & 0xFF;
+    out[3] = (value >> 24) & 0xFF;
+}
+
+
+static inline uint32_t read_le32(const uint8_t *in)
+{
+    return (uint32_t)in[0] | ((uint32_t)in[1] << 8) | ((uint32_t)in[2] << 16) | ((uint32_t)in[3] << 24);
+}
+
+
+PartialEncoder::PartialEncoder(size_t block_size, int keyframe_interval)
+{
+    _block_size = block_size;
+    _keyframe_interval = keyframe_interval;
+    _since_keyframe = 0;
+    _acked = 0;
+    _have_ack = false;
+    _force_keyframe = true;
+}
+
+
+void PartialEncoder::set_block_size(size_t block_size)
+{
+    if (block_size != _block_size) {
+        _block_size = block_size;
+        _last.clear();
+    }
+}
+
+
+void PartialEncoder::reserve(size_t len, size_t blocks)
+{
+    _last.reserve(len);
+    _changed_at.reserve(blocks);
+    _ranges.reserve(blocks);
+}
+
+
+size_t PartialEncoder::update(const uint8_t *payload, size_t len, uint32_t frame_id)
+{
+    size_t blocks = (len + _block_size - 1) / _block_size;
+
+    if (_last.size() != len) {
+        // Strand layout changed, nothing we know about the receiver holds any more
+        _last.assign(payload, payload + len);
+        _changed_at.assign(blocks, frame_id);
+        _ranges.reserve(blocks);
+        _have_ack = false;
+        _force_keyframe = true;
+    } else {
+        for (size_t block = 0; block < blocks; block++) {
+            size_t offset = block * _block_size;
+            size_t size = (offset + _block_size <= len) ? _block_size : len - offset;
+
+            if (memcmp(payload + offset, &_last[offset], size) != 0) {
+                memcpy(&_last[offset], payload + offset, size);
+                _changed_at[block] = frame_id;
+            }
+        }
+    }
+
+    _since_keyframe++;
+    if (_force_keyframe || !_have_ack || _since_keyframe >= _keyframe_interval) {
+        _force_keyframe = false;
+        _since_keyframe = 0;
+        return 0;
+    }
+
+    // Everything that changed after the frame the receiver last confirmed
+    _ranges.clear();
+    size_t size = PARTIAL_HEADER_SIZE;
+
+    for (size_t block = 0; block < blocks; block++) {
+        if ((int32_t)(_changed_at[block] - _acked) <= 0) {
+            continue;
+        }
+
+        uint32_t offset = block * _block_size;
+        uint32_t length = ((offset + _block_size <= len) ? _block_size : len - offset);
+
+        if (!_ranges.empty() && _ranges.back().offset + _ranges.back().length == offset) {
+            _ranges.back().length += length;
+        } else {
+            Range range = {offset, length};
+            _ranges.push_back(range);
+            size += PARTIAL_RANGE_HEADER_SIZE;
+        }
+        size += length;
+    }
+
+    // Not worth it, and a full frame doubles as a keyframe
+    if (size >= len) {
+        _since_keyframe = 0;
+        return 0;
+    }
+
+    return size;
+}
+
+
+void PartialEncoder::write_partial(const uint8_t *payload, uint8_t *out) const
+{
+    write_le32(out, _acked);
+    write_le32(out + 4, _ranges.size());
+    out += PARTIAL_HEADER_SIZE;
+
+    for (size_t i = 0; i < _ranges.size(); i++) {
+        write_le32(out, _ranges[i].offset);
+        write_le32(out + 4, _ranges[i].length);
+        memcpy(out + PARTIAL_RANGE_HEADER_SIZE, payload + _ranges[i].offset, _ranges[i].length);
+        out += PARTIAL_RANGE_HEADER_SIZE + _ranges[i].length;
+    }
+}
+
+
+void PartialEncoder::ack(uint32_t frame_id)
+{
+    if (!_have_ack || (int32_t)(frame_id - _acked) > 0) {
+        _acked = frame_id;
+        _have_ack = true;
+    }
+}
+
+
+void PartialEncoder::reject()
+{
+    // The receiver's state is unknown until it confirms a full frame
+    _have_ack = false;
+    _force_keyframe = true;
+}
+
+
+bool apply_partial(uint8_t *frame, size_t frame_len, const uint8_t *payload, size_t len, uint32_t *base_id)
+{
+    if (len < PARTIAL_HEADER_SIZE) {
+        return false;
+    }
+
+    *base_id = read_le32(payload);
+    uint32_t count = read_le32(payload + 4);
+
+    // Validate everything before touching the frame
+    size_t pos = PARTIAL_HEADER_SIZE;
+    for (uint32_t i = 0; i < count; i++) {
+        if (len - pos < PARTIAL_RANGE_HEADER_SIZE) {
+            return false;
+        }
+
+        uint32_t offset = read_le32(payload + pos);
+        uint32_t length = read_le32(payload + pos + 4);
+        pos += PARTIAL_RANGE_HEADER_SIZE;
+
+        if (offset > frame_len || length > frame_len - offset || length > len - pos) {
+            return false;
+        }
+        pos += length;
+    }
+
+    pos = PARTIAL_HEADER_SIZE;
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t offset = read_le32(payload + pos);
+        uint32_t length = read_le32(payload + pos + 4);
+        memcpy(frame + offset, payload + pos + PARTIAL_RANGE_HEADER_SIZE, length);
+        pos += PARTIAL_RANGE_HEADER_SIZE + length;
+    }
+
+    return true;
+}
@@ -0,0 +1,98 @@
+// FireNode
+// Copyright (c) 2013 Jon Evans
+// http://craftyjon.com/projects/openlights/firenode
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#ifndef _PARTIAL_H
+#define _PARTIAL_H
+
+#include "portability.h"
+
+#include <cstddef>
+#include <vector>
+
+
+// Partial frame payload (PROTOCOL_TYPE_PARTIAL):
+//
+//   0    4    base frame id: the last frame the receiver acknowledged
+//   4    4    range count
+//   8    ...  per range: offset (4), length (4), then length bytes of frame data
+//
+// All fields little endian.  The receiver only applies a partial frame if it
+// has already shown the base frame (or a later one), otherwise it replies
+// PROTOCOL_REPLY_REJECT and the host follows up with a full frame.
+
+#define PARTIAL_HEADER_SIZE 8
+#define PARTIAL_RANGE_HEADER_SIZE 8
+#define PARTIAL_DEFAULT_KEYFRAME_INTERVAL 100
+
+
+//! Decides, frame by frame, whether a full frame or only the changed ranges need to go out.
+//!
+//! The frame is split into blocks (one pixel column of the bit-plane buffer).
+//! For every block we remember the last frame in which it changed.  A partial
+//! frame carries every block that changed after the last acknowledged frame,
+//! which is correct whichever of the unacknowledged frames the receiver
+//! actually got.
+class PartialEncoder
+{
+public:
+    PartialEncoder(size_t block_size, int keyframe_interval);
+
+    //! Changes the block size, e.g. when the pixel format changes.  Starts
+    //! over with a keyframe.
+    void set_block_size(size_t block_size);
+    //! Preallocates for payloads of up to len bytes in up to blocks blocks.
+    void reserve(size_t len, size_t blocks);
+
+    //! Records frame_id and plans how to send it.  Returns the size of the
+    //! partial payload, or 0 if this frame should go out as a full frame.
+    size_t update(const uint8_t *payload, size_t len, uint32_t frame_id);
+    //! Writes the partial payload planned by the last update().
+    void write_partial(const uint8_t *payload, uint8_t *out) const;
+
+    void ack(uint32_t frame_id);
+    void reject(void);
+
+private:
+    struct Range {
+        uint32_t offset;
+        uint32_t length;
+    };
+
+    size_t _block_size;
+    int _keyframe_interval;
+    int _since_keyframe;
+
+    std::vector<uint8_t> _last;
+    std::vector<uint32_t> _changed_at;
+    std::vector<Range> _ranges;
+
+    uint32_t _acked;
+    bool _have_ack;
+    bool _force_keyframe;
+};
+
+
+//! Host-side reference for applying a partial payload on the receiver.
+//! Returns false (and leaves frame untouched) if the payload is malformed.
+bool apply_partial(uint8_t *frame, size_t frame_len, const uint8_t *payload, size_t len, uint32_t *base_id);
+
+#endif
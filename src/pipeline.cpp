@@ -0,0 +1,279 @@
+// FireNode
+// Copyright (c) 2013 Jon Evans
+// http://craftyjon.com/projects/openlights/firenode
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+
+#include "pipeline.h"
+#include "alloc_tracker.h"
+
+#include <cstring>
+
+#include <QtCore/QDebug>
+
+
+StageStats::StageStats(const char *stage)
+{
+    _stage = stage;
+    _output = 0;
+    _frames = 0;
+    _depth_sum = 0;
+    _depth_max = 0;
+    _dropped = 0;
+}
+
+
+void StageStats::pushed(int depth, int capacity, bool dropped)
+{
+    _frames++;
+    _depth_sum += depth;
+    _depth_max = qMax(_depth_max, depth);
+    _dropped += dropped ? 1 : 0;
+
+    if (_frames < PIPELINE_STATS_FRAMES) {
+        return;
+    }
+
+    IgnoreAllocations ignore;
+    qDebug("Output %d %s queue: depth avg %.2f max %d of %d, %d dropped", _output, _stage,
+           (double)_depth_sum / _frames, _depth_max, capacity, _dropped);
+
+    _frames = 0;
+    _depth_sum = 0;
+    _depth_max = 0;
+    _dropped = 0;
+}
+
+
+StrandQueue::StrandQueue()
+    : _stats("assemble")
+{
+    _depth = PIPELINE_DEFAULT_DEPTH;
+    _count = 0;
+    _length = 0;
+    _width = 1;
+    _head = 0;
+    _queued = 0;
+    _level.assign(_depth, 0);
+    _pts.assign(_depth, -1);
+}
+
+
+void StrandQueue::set_depth(int frames, int output)
+{
+    QMutexLocker locker(&_lock);
+
+    _depth = qBound(1, frames, PIPELINE_MAX_DEPTH);
+    _level.assign(_depth, 0);
+    _pts.assign(_depth, -1);
+    _stats.set_output(output);
+    layout(_count, _length, _width);
+}
+
+
+void StrandQueue::reserve(int count, int length)
+{
+    QMutexLocker locker(&_lock);
+    layout(count, length, _width);
+}
+
+
+void StrandQueue::layout(int count, int length, int width)
+{
+    // Whatever is queued is laid out for the old size
+    _count = count;
+    _length = length;
+    _width = width;
+    _data.assign((size_t)_depth * count * length, 0);
+    _head = 0;
+    _queued = 0;
+}
+
+
+uint8_t *StrandQueue::slot(int index)
+{
+    // Strands packed back to back, this copy is only ever read front to back
+    return _data.data() + (size_t)index * _count * _length;
+}
+
+
+void StrandQueue::push(const StrandView &frame, uint64_t level, qint64 pts)
+{
+    QMutexLocker locker(&_lock);
+
+    if (frame.count != _count || frame.length != _length || frame.width != _width) {
+        layout(frame.count, frame.length, frame.width);
+    }
+
+    bool dropped = (_queued == _depth);
+    if (dropped) {
+        _head = (_head + 1) % _depth;
+        _queued--;
+    }
+
+    int index = (_head + _queued) % _depth;
+    uint8_t *queued = slot(index);
+    for (int i = 0; i < frame.count; i++) {
+        memcpy(queued + (size_t)i * _length, frame.strand(i), _length);
+    }
+    _level[index] = level;
+    _pts[index] = pts;
+    _queued++;
+
+    _stats.pushed(_queued, _depth, dropped);
+}
+
+
+int StrandQueue::length()
+{
+    QMutexLocker locker(&_lock);
+    return _length;
+}
+
+
+int StrandQueue::width()
+{
+    QMutexLocker locker(&_lock);
+    return _width;
+}
+
+
+bool StrandQueue::pop(const StrandView &out, uint64_t *level, qint64 *pts)
+{
+    QMutexLocker locker(&_lock);
+
+    if (_queued == 0) {
+        return false;
+    }
+
+    return take(out, level, pts);
+}
+
+
+bool StrandQueue::pop_newest(const StrandView &out, uint64_t *level, qint64 *pts)
+{
+    QMutexLocker locker(&_lock);
+
+    if (_queued == 0) {
+        return false;
+    }
+
+    int skipped = _queued - 1;
+    _head = (_head + skipped) % _depth;
+    _queued = 1;
+    _stats.dropped(skipped);
+
+    take(out, level, pts);
+    return true;
+}
+
+
+bool StrandQueue::take(const StrandView &out, uint64_t *level, qint64 *pts)
+{
+    // Called with _lock held and a frame queued.  Its layout changed since
+    // out was laid out, and bytes of the other width would be misread.
+    if (out.width != _width) {
+        _head = (_head + 1) % _depth;
+        _queued--;
+        _stats.dropped(1);
+        return false;
+    }
+
+    const uint8_t *queued = slot(_head);
+    int length = qMin(_length, out.length);
+    for (int i = 0; i < out.count; i++) {
+        if (i < _count) {
+            memcpy(out.strand(i), queued + (size_t)i * _length, length);
+            memset(out.strand(i) + length, 0, out.length - length);
+        } else {
+            memset(out.strand(i), 0, out.length);
+        }
+    }
+    *level = _level[_head];
+    *pts = _pts[_head];
+
+    _head = (_head + 1) % _depth;
+    _queued--;
+    return true;
+}
+
+
+FrameQueue::FrameQueue()
+    : _stats("write")
+{
+    _depth = PIPELINE_DEFAULT_DEPTH;
+    _head = 0;
+    _queued = 0;
+}
+
+
+void FrameQueue::set_depth(int frames, int output)
+{
+    QMutexLocker locker(&_lock);
+
+    _depth = qBound(1, frames, PIPELINE_MAX_DEPTH);
+    _head = 0;
+    _queued = 0;
+    _stats.set_output(output);
+}
+
+
+void FrameQueue::reserve(int bytes)
+{
+    QMutexLocker locker(&_lock);
+
+    for (int i = 0; i < _depth; i++) {
+        _frames[i].reserve(bytes);
+    }
+}
+
+
+void FrameQueue::push(const OutputFrame &frame)
+{
+    QMutexLocker locker(&_lock);
+
+    bool dropped = (_queued == _depth);
+    if (dropped) {
+        _head = (_head + 1) % _depth;
+        _queued--;
+    }
+
+    _frames[(_head + _queued) % _depth].assign(frame);
+    _queued++;
+
+    _stats.pushed(_queued, _depth, dropped);
+}
+
+
+bool FrameQueue::pop(FrameBuffer *out)
+{
+    QMutexLocker locker(&_lock);
+
+    if (_queued == 0) {
+        return false;
+    }
+
+    // The writer's old buffer takes the slot, so nothing is copied or allocated
+    out->swap(_frames[_head]);
+    _head = (_head + 1) % _depth;
+    _queued--;
+
+    return true;
+}
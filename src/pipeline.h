@@ -0,0 +1,134 @@
+// FireNode
+// Copyright (c) 2013 Jon Evans
+// http://craftyjon.com/projects/openlights/firenode
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+
+#ifndef _PIPELINE_H
+#define _PIPELINE_H
+
+#include "portability.h"
+#include "strand_store.h"
+#include "frame.h"
+
+#include <vector>
+
+#include <QtCore/QMutex>
+
+
+// Frames are received, assembled and written by different threads.  Between
+// each two stages sits a queue of up to "pipeline-depth" frames; when one is
+// full the oldest frame in it is dropped, so a slow stage costs frames rather
+// than latency, and throughput is set by the slowest stage alone.
+
+#define PIPELINE_DEFAULT_DEPTH 2
+#define PIPELINE_MAX_DEPTH 16
+#define PIPELINE_STATS_FRAMES 1000
+
+
+//! How full the queue in front of a stage runs.
+class StageStats
+{
+public:
+    StageStats(const char *stage);
+
+    void set_output(int output) { _output = output; }
+    //! A frame was queued, leaving depth frames in a queue of capacity.
+    //! Prints the occupancy every PIPELINE_STATS_FRAMES frames.
+    void pushed(int depth, int capacity, bool dropped);
+    //! frames were taken off the queue without being used.
+    void dropped(int frames) { _dropped += frames; }
+
+private:
+    const char *_stage;
+    int _output;
+    int _frames;
+    qint64 _depth_sum;
+    int _depth_max;
+    int _dropped;
+};
+
+
+//! Received strands waiting to be assembled.  Thread safe.
+class StrandQueue
+{
+public:
+    StrandQueue();
+
+    void set_depth(int frames, int output);
+    //! Makes room for count strands of length bytes.
+    void reserve(int count, int length);
+
+    //! Queues a copy of frame with its power level and presentation time.
+    void push(const StrandView &frame, uint64_t level, qint64 pts);
+    //! Strand length and channel width of the frames queued, for laying out
+    //! what they are popped into.
+    int length(void);
+    int width(void);
+    //! Copies the oldest frame into out, past its length padded dark.  A frame
+    //! of another channel width than out is dropped instead.
+    bool pop(const StrandView &out, uint64_t *level, qint64 *pts);
+    //! Like pop(), but takes the newest frame and drops the older ones.
+    bool pop_newest(const StrandView &out, uint64_t *level, qint64 *pts);
+
+private:
+    void layout(int count, int length, int width);
+    bool take(const StrandView &out, uint64_t *level, qint64 *pts);
+    uint8_t *slot(int index);
+
+    QMutex _lock;
+    std::vector<uint8_t> _data;
+    int _depth;
+    int _count;
+    int _length;
+    int _width;
+    std::vector<uint64_t> _level;
+    std::vector<qint64> _pts;
+    int _head;
+    int _queued;
+    StageStats _stats;
+};
+
+
+//! Assembled frames waiting to be written.  Thread safe.
+class FrameQueue
+{
+public:
+    FrameQueue();
+
+    void set_depth(int frames, int output);
+    //! Preallocates for payloads of up to bytes.
+    void reserve(int bytes);
+
+    //! Queues a copy of frame.
+    void push(const OutputFrame &frame);
+    //! Swaps the oldest frame into out.  Leaves out alone if there is none.
+    bool pop(FrameBuffer *out);
+
+private:
+    QMutex _lock;
+    FrameBuffer _frames[PIPELINE_MAX_DEPTH];
+    int _depth;
+    int _head;
+    int _queued;
+    StageStats _stats;
+};
+
+#endif
@@ -0,0 +1,66 @@
+// FireNode
+// Copyright (c) 2013 Jon Evans
+// http://craftyjon.com/projects/openlights/firenode
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+
+#include "power.h"
+#include "alloc_tracker.h"
+
+#include <QtCore/QDebug>
+
+
+PowerBudget::PowerBudget(double budget_ma, int outputs)
+{
+    _budget_ma = budget_ma;
+    _draw_ma.assign(outputs, 0);
+    _limiting = false;
+}
+
+
+uint32_t PowerBudget::limit(int output, double draw_ma)
+{
+    QMutexLocker locker(&_lock);
+
+    _draw_ma[output] = draw_ma;
+
+    double total = 0;
+    for (size_t i = 0; i < _draw_ma.size(); i++) {
+        total += _draw_ma[i];
+    }
+
+    if (total <= _budget_ma) {
+        if (_limiting) {
+            IgnoreAllocations ignore;
+            qDebug("Power back within the %.0f mA budget", _budget_ma);
+            _limiting = false;
+        }
+        return POWER_SCALE_ONE;
+    }
+
+    if (!_limiting) {
+        IgnoreAllocations ignore;
+        qDebug("Estimated draw %.0f mA is over the %.0f mA budget, dimming", total, _budget_ma);
+        _limiting = true;
+    }
+
+    // Rounded down, so the scaled frames never exceed the budget
+    return (uint32_t)(_budget_ma / total * POWER_SCALE_ONE);
+}
@@ -0,0 +1,76 @@
+// FireNode
+// Copyright (c) 2013 Jon Evans
+// http://craftyjon.com/projects/openlights/firenode
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+
+#ifndef _POWER_H
+#define _POWER_H
+
+#include "portability.h"
+
+#include <vector>
+
+#include <QtCore/QMutex>
+
+
+// Current budgets.
+//
+// Every channel byte is taken to draw ma_per_channel * value / 255 mA, so a
+// frame's draw is proportional to its level: the sum of all its channel bytes.
+// The unpack kernels add that up as they copy each strand in (see
+// src/color_order.h), so the estimate needs no pass of its own.  A frame over
+// budget is dimmed while it is transposed, by a fixed point factor out of
+// POWER_SCALE_ONE.
+
+// A WS2812 channel at full brightness
+#define POWER_DEFAULT_MA_PER_CHANNEL 20.0
+
+#define POWER_SCALE_BITS 16
+#define POWER_SCALE_ONE (1 << POWER_SCALE_BITS)
+
+
+inline uint8_t power_scale(uint8_t value, uint32_t scale)
+{
+    return (value * scale) >> POWER_SCALE_BITS;
+}
+
+
+//! A current limit shared by one or more outputs.
+//!
+//! Each output reports the draw of the frame it is about to send.  If the
+//! latest draws of all of them add up to more than the budget, every one is
+//! scaled down by the same factor.
+class PowerBudget
+{
+public:
+    PowerBudget(double budget_ma, int outputs = 1);
+
+    //! Records the draw of output's next frame.  Returns the scale to send it at.
+    uint32_t limit(int output, double draw_ma);
+
+private:
+    QMutex _lock;
+    double _budget_ma;
+    std::vector<double> _draw_ma;
+    bool _limiting;
+};
+
+#endif
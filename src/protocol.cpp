@@ -0,0 +1,291 @@
+// FireNode
+// Copyright (c) 2013 Jon Evans
+// http://craftyjon.com/projects/openlights/firenode
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#include "protocol.h"
+
+#include <cstring>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_CRC32C_SSE42
+#include <nmmintrin.h>
+#elif defined(__ARM_FEATURE_CRC32)
+#define HAVE_CRC32C_ARM
+#include <arm_acle.h>
+#endif
+
+
+#define CRC32C_POLY 0x82F63B78
+
+
+static inline void write_le32(uint8_t *out, uint32_t value)
+{
+    out[0] = value & 0xFF;
+    out[1] = (value >> 8) & 0xFF;
+    out[2] = (value >> 16) & 0xFF;
+    out[3] = (value >> 24) & 0xFF;
+}
+
+
+static inline uint32_t read_le32(const uint8_t *in)
+{
+    return (uint32_t)in[0] | ((uint32_t)in[1] << 8) | ((uint32_t)in[2] << 16) | ((uint32_t)in[3] << 24);
+}
+
+
+static inline bool is_magic(const uint8_t *p)
+{
+    return p[0] == PROTOCOL_MAGIC_0 && p[1] == PROTOCOL_MAGIC_1 &&
+           p[2] == PROTOCOL_MAGIC_2 && p[3] == PROTOCOL_MAGIC_3;
+}
+
+
+static uint32_t crc32c_table[256];
+
+static bool init_crc32c_table()
+{
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t crc = i;
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc >> 1) ^ ((crc & 1) ? CRC32C_POLY : 0);
+        }
+        crc32c_table[i] = crc;
+    }
+    return true;
+}
+
+static bool crc32c_table_ready = init_crc32c_table();
+
+
+static uint32_t crc32c_sw(uint32_t crc, const uint8_t *data, size_t len)
+{
+    for (size_t i = 0; i < len; i++) {
+        crc = crc32c_table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return crc;
+}
+
+
+#ifdef HAVE_CRC32C_SSE42
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_hw(uint32_t crc, const uint8_t *data, size_t len)
+{
+#ifdef __x86_64__
+    uint64_t crc64 = crc;
+    while (len >= 8) {
+        uint64_t word;
+        memcpy(&word, data, 8);
+        crc64 = _mm_crc32_u64(crc64, word);
+        data += 8;
+        len -= 8;
+    }
+    crc = (uint32_t)crc64;
+#endif
+    while (len >= 4) {
+        uint32_t word;
+        memcpy(&word, data, 4);
+        crc = _mm_crc32_u32(crc, word);
+        data += 4;
+        len -= 4;
+    }
+    while (len > 0) {
+        crc = _mm_crc32_u8(crc, *data);
+        data++;
+        len--;
+    }
+    return crc;
+}
+
+static bool crc32c_have_hw = __builtin_cpu_supports("sse4.2");
+#elif defined(HAVE_CRC32C_ARM)
+static uint32_t crc32c_hw(uint32_t crc, const uint8_t *data, size_t len)
+{
+    while (len >= 8) {
+        uint64_t word;
+        memcpy(&word, data, 8);
+        crc = __crc32cd(crc, word);
+        data += 8;
+        len -= 8;
+    }
+    while (len > 0) {
+        crc = __crc32cb(crc, *data);
+        data++;
+        len--;
+    }
+    return crc;
+}
+
+static bool crc32c_have_hw = true;
+#endif
+
+
+uint32_t crc32c(const uint8_t *data, size_t len, uint32_t crc)
+{
+    crc = ~crc;
+
+#if defined(HAVE_CRC32C_SSE42) || defined(HAVE_CRC32C_ARM)
+    if (crc32c_have_hw) {
+        return ~crc32c_hw(crc, data, len);
+    }
+#endif
+
+    (void)crc32c_table_ready;
+    return ~crc32c_sw(crc, data, len);
+}
+
+
+void seal_frame(uint8_t *frame, const uint8_t *payload, uint8_t *trailer, const FrameHeader &header)
+{
+    frame[0] = PROTOCOL_MAGIC_0;
+    frame[1] = PROTOCOL_MAGIC_1;
+    frame[2] = PROTOCOL_MAGIC_2;
+    frame[3] = PROTOCOL_MAGIC_3;
+    frame[4] = header.type;
+    frame[5] = header.flags;
+    frame[6] = header.format;
+    frame[7] = 0;
+    write_le32(frame + 8, header.length);
+    write_le32(frame + 12, header.frame_id);
+
+    uint32_t crc = crc32c(frame, PROTOCOL_HEADER_SIZE);
+    write_le32(trailer, crc32c(payload, header.length, crc));
+}
+
+
+ReplyParser::ReplyParser()
+{
+    _length = 0;
+}
+
+
+bool ReplyParser::push(uint8_t byte, uint8_t *kind, uint32_t *frame_id)
+{
+    // Anything that doesn't start a reply is line noise
+    if (_length == 0 && byte != PROTOCOL_REPLY_ACK && byte != PROTOCOL_REPLY_REJECT) {
+        return false;
+    }
+
+    _reply[_length++] = byte;
+    if (_length < PROTOCOL_REPLY_SIZE) {
+        return false;
+    }
+
+    _length = 0;
+    *kind = _reply[0];
+    *frame_id = read_le32(_reply + 1);
+
+    return true;
+}
+
+
+FrameDecoder::FrameDecoder(size_t max_payload)
+{
+    _max_payload = max_payload;
+    _start = 0;
+    _frames = 0;
+    _crc_errors = 0;
+    _skipped = 0;
+}
+
+
+void FrameDecoder::push(const uint8_t *data, size_t len)
+{
+    // Drop whatever pop() has already consumed before growing the buffer
+    if (_start > 0) {
+        _buffer.erase(_buffer.begin(), _buffer.begin() + _start);
+        _start = 0;
+    }
+
+    _buffer.insert(_buffer.end(), data, data + len);
+}
+
+
+void FrameDecoder::discard(size_t count)
+{
+    _start += count;
+}
+
+
+bool FrameDecoder::pop(FrameHeader *header, const uint8_t **payload)
+{
+    for (;;) {
+        const uint8_t *p = _buffer.data() + _start;
+        size_t avail = _buffer.size() - _start;
+
+        size_t skip = 0;
+        while (skip + PROTOCOL_MAGIC_SIZE <= avail && !is_magic(p + skip)) {
+            skip++;
+        }
+
+        if (skip + PROTOCOL_MAGIC_SIZE > avail) {
+            // Hold on to a tail that could still turn out to be the start of a magic
+            skip = (avail > PROTOCOL_MAGIC_SIZE - 1) ? avail - (PROTOCOL_MAGIC_SIZE - 1) : 0;
+            _skipped += skip;
+            discard(skip);
+            return false;
+        }
+
+        if (skip > 0) {
+            _skipped += skip;
+            discard(skip);
+            continue;
+        }
+
+        if (avail < PROTOCOL_HEADER_SIZE) {
+            return false;
+        }
+
+        FrameHeader h;
+        h.type = p[4];
+        h.flags = p[5];
+        h.format = p[6];
+        h.length = read_le32(p + 8);
+        h.frame_id = read_le32(p + 12);
+
+        if (h.length > _max_payload) {
+            // Not a real header, look for the next magic
+            _skipped++;
+            discard(1);
+            continue;
+        }
+
+        size_t covered = PROTOCOL_HEADER_SIZE + h.length;
+        if (avail < covered + PROTOCOL_TRAILER_SIZE) {
+            return false;
+        }
+
+        if (crc32c(p, covered) != read_le32(p + covered)) {
+            // Bytes went missing, so this "frame" ran into the next one.  Rescan
+            // from just past this magic and pick the next frame up where it starts.
+            _crc_errors++;
+            _skipped++;
+            discard(1);
+            continue;
+        }
+
+        *header = h;
+        *payload = p + PROTOCOL_HEADER_SIZE;
+        discard(covered + PROTOCOL_TRAILER_SIZE);
+        _frames++;
+
+        return true;
+    }
+}
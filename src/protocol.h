@@ -0,0 +1,142 @@
+// FireNode
+// Copyright (c) 2013 Jon Evans
+// http://craftyjon.com/projects/openlights/firenode
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#ifndef _PROTOCOL_H
+#define _PROTOCOL_H
+
+#include "portability.h"
+
+#include <cstddef>
+#include <vector>
+
+
+// Serial link framing, version 2.
+//
+//   offset  size  field
+//   0       4     magic "FNv2"
+//   4       1     type (PROTOCOL_TYPE_*)
+//   5       1     flags (PROTOCOL_FLAG_*)
+//   6       1     format (PROTOCOL_FORMAT_*, see src/bit_depth.h)
+//   7       1     reserved (0)
+//   8       4     payload length, little endian
+//   12      4     frame counter, little endian
+//   16      n     payload (RLE encoded if PROTOCOL_FLAG_RLE, see src/rle.h)
+//   16+n    4     CRC-32C of bytes [0, 16+n), little endian
+//
+// The receiver answers every frame it applies with PROTOCOL_REPLY_ACK and the
+// frame counter (4 bytes, little endian), and every partial frame it cannot
+// apply with PROTOCOL_REPLY_REJECT and its current frame counter.
+//
+// Version 1 is a single '*' followed by the raw payload.
+
+#define PROTOCOL_V1_START '*'
+
+#define PROTOCOL_MAGIC_0 'F'
+#define PROTOCOL_MAGIC_1 'N'
+#define PROTOCOL_MAGIC_2 'v'
+#define PROTOCOL_MAGIC_3 '2'
+#define PROTOCOL_MAGIC_SIZE 4
+
+#define PROTOCOL_HEADER_SIZE 16
+#define PROTOCOL_TRAILER_SIZE 4
+#define PROTOCOL_OVERHEAD (PROTOCOL_HEADER_SIZE + PROTOCOL_TRAILER_SIZE)
+
+#define PROTOCOL_TYPE_FULL 'F'
+#define PROTOCOL_TYPE_PARTIAL 'P'
+
+#define PROTOCOL_FLAG_RLE 0x01
+
+// Bit planes per channel in each pixel column of the payload
+#define PROTOCOL_FORMAT_888 0
+#define PROTOCOL_FORMAT_565 1
+#define PROTOCOL_FORMAT_444 2
+
+#define PROTOCOL_REPLY_ACK 'A'
+#define PROTOCOL_REPLY_REJECT 'N'
+#define PROTOCOL_REPLY_SIZE 5
+
+
+struct FrameHeader
+{
+    uint8_t type;
+    uint8_t flags;
+    uint8_t format;
+    uint32_t length;
+    uint32_t frame_id;
+};
+
+
+//! CRC-32C (Castagnoli).  Uses the SSE4.2 / ARMv8 crc32 instructions when the CPU has them.
+//! Pass the previous result as crc to continue a running checksum.
+uint32_t crc32c(const uint8_t *data, size_t len, uint32_t crc = 0);
+
+//! Writes the PROTOCOL_HEADER_SIZE header bytes and PROTOCOL_TRAILER_SIZE CRC bytes
+//! that go around header.length bytes of payload, which stays where it is.
+void seal_frame(uint8_t *out_header, const uint8_t *payload, uint8_t *out_trailer, const FrameHeader &header);
+
+
+//! Picks acknowledgements out of the bytes a v2 receiver sends back.
+class ReplyParser
+{
+public:
+    ReplyParser();
+
+    //! Returns true once a whole reply has been read.
+    bool push(uint8_t byte, uint8_t *kind, uint32_t *frame_id);
+
+private:
+    uint8_t _reply[PROTOCOL_REPLY_SIZE];
+    int _length;
+};
+
+
+//! Host-side reference for the decoder the firmware runs.
+//!
+//! Feed it whatever arrives on the wire with push(), then call pop() until it
+//! returns false.  After a bad CRC the decoder rescans the bytes it just
+//! rejected for the next magic, so it is back in sync by the following frame.
+class FrameDecoder
+{
+public:
+    FrameDecoder(size_t max_payload);
+
+    void push(const uint8_t *data, size_t len);
+    //! Returns the next good frame.  payload stays valid until the next push() or pop().
+    bool pop(FrameHeader *header, const uint8_t **payload);
+
+    unsigned long long frames(void) const { return _frames; }
+    unsigned long long crc_errors(void) const { return _crc_errors; }
+    unsigned long long skipped(void) const { return _skipped; }
+
+private:
+    void discard(size_t count);
+
+    size_t _max_payload;
+    std::vector<uint8_t> _buffer;
+    size_t _start;
+
+    unsigned long long _frames;
+    unsigned long long _crc_errors;
+    unsigned long long _skipped;
+};
+
+#endif
@@ -0,0 +1,206 @@
+// FireNode
+// Copyright (c) 2013 Jon Evans
+// http://craftyjon.com/projects/openlights/firenode
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+
+#include "realtime.h"
+
+#include <cerrno>
+#include <cstring>
+
+#include <QtCore/QDebug>
+
+#ifdef Q_OS_LINUX
+#include <pthread.h>
+#include <sched.h>
+#include <malloc.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+
+
+#ifdef Q_OS_LINUX
+// End of the heap when realtime_keep_heap() ran
+static char *heap_start = NULL;
+#endif
+
+
+RealtimePolicy::RealtimePolicy(const QString name)
+{
+    _name = name;
+    _priority = 0;
+    _prefault = false;
+    _warned = 0;
+}
+
+
+void RealtimePolicy::set_cpus(const QList<int> &cpus)
+{
+    _cpus = cpus;
+}
+
+
+void RealtimePolicy::set_priority(int priority)
+{
+    _priority = priority;
+}
+
+
+void RealtimePolicy::set_prefault_stack(bool enabled)
+{
+    _prefault = enabled;
+}
+
+
+void RealtimePolicy::warn(int step, const char *what, int error)
+{
+    // Once per step and policy, not once for every thread of a pool
+    if ((_warned.fetchAndOrOrdered(step) & step) == 0) {
+        qWarning("Realtime %s: could not %s (%s), carrying on without.",
+                 qPrintable(_name), what, strerror(error));
+    }
+}
+
+
+void RealtimePolicy::apply()
+{
+#ifdef Q_OS_LINUX
+    if (!_cpus.isEmpty()) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for (int i = 0; i < _cpus.size(); i++) {
+            CPU_SET(_cpus[i], &set);
+        }
+
+        int rc = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+        if (rc != 0) {
+            warn(STEP_AFFINITY, "set CPU affinity", rc);
+        }
+    }
+
+    if (_priority > 0) {
+        struct sched_param param;
+        memset(&param, 0, sizeof(param));
+        param.sched_priority = qBound(sched_get_priority_min(SCHED_FIFO), _priority,
+                                      sched_get_priority_max(SCHED_FIFO));
+
+        // EPERM without CAP_SYS_NICE or an RLIMIT_RTPRIO that allows it
+        int rc = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+        if (rc != 0) {
+            warn(STEP_PRIORITY, "switch to SCHED_FIFO", rc);
+        }
+    }
+
+    if (_prefault) {
+        // Every page the thread will need for its stack is mapped before the first frame
+        char stack[REALTIME_STACK_PREFAULT];
+        volatile char *touch = stack;
+        for (int i = 0; i < REALTIME_STACK_PREFAULT; i += 4096) {
+            touch[i] = 0;
+        }
+    }
+#else
+    if (!_cpus.isEmpty()) {
+        warn(STEP_AFFINITY, "set CPU affinity", ENOSYS);
+    }
+    if (_priority > 0) {
+        warn(STEP_PRIORITY, "switch to SCHED_FIFO", ENOSYS);
+    }
+#endif
+}
+
+
+void realtime_prepare_thread(QThread *thread, RealtimePolicy *policy)
+{
+    thread->setStackSize(REALTIME_THREAD_STACK);
+    if (policy != NULL) {
+        QObject::connect(thread, SIGNAL(started()), policy, SLOT(apply()), Qt::DirectConnection);
+    }
+}
+
+
+bool realtime_start_thread(QThread *thread, const char *name)
+{
+    // QThread::start() only warns when the thread cannot be created, leaving
+    // it neither running nor finished
+    thread->start();
+    if (!thread->isRunning() && !thread->isFinished()) {
+        qWarning("Could not start the %s thread.", name);
+        return false;
+    }
+    return true;
+}
+
+
+void realtime_keep_heap()
+{
+#ifdef Q_OS_LINUX
+    // Large blocks would otherwise get mappings of their own, and freed memory
+    // at the top of the heap would go back to the system
+    mallopt(M_MMAP_MAX, 0);
+    mallopt(M_TRIM_THRESHOLD, -1);
+    heap_start = (char *)sbrk(0);
+#endif
+}
+
+
+void realtime_prefault_heap()
+{
+#ifdef Q_OS_LINUX
+    if (heap_start == NULL) {
+        return;
+    }
+
+    long page = sysconf(_SC_PAGESIZE);
+    char *start = (char *)((uintptr_t)heap_start & ~(uintptr_t)(page - 1));
+    char *end = (char *)sbrk(0);
+    if (end <= start) {
+        return;
+    }
+
+#ifdef MADV_POPULATE_WRITE
+    // Maps every page writable without touching what is in them
+    if (madvise(start, end - start, MADV_POPULATE_WRITE) == 0) {
+        qDebug("Realtime: prefaulted %ld KiB of frame buffers", (long)((end - start) / 1024));
+        return;
+    }
+    qWarning("Realtime: could not prefault frame buffers (%s), carrying on without.", strerror(errno));
+#else
+    qWarning("Realtime: prefaulting needs MADV_POPULATE_WRITE (Linux 5.14), carrying on without.");
+#endif
+#endif
+}
+
+
+bool realtime_lock_memory()
+{
+#ifdef Q_OS_LINUX
+    // EPERM or ENOMEM when RLIMIT_MEMLOCK is too low and CAP_IPC_LOCK is missing
+    if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0) {
+        qWarning("Realtime: could not lock memory (%s), pages may still be swapped out.", strerror(errno));
+        return false;
+    }
+    return true;
+#else
+    qWarning("Realtime: locking memory is only supported on Linux.");
+    return false;
+#endif
+}
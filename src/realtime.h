@@ -0,0 +1,102 @@
+// FireNode
+// Copyright (c) 2013 Jon Evans
+// http://craftyjon.com/projects/openlights/firenode
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+
+#ifndef _REALTIME_H
+#define _REALTIME_H
+
+#include "portability.h"
+
+#include <QtCore/QObject>
+#include <QtCore/QList>
+#include <QtCore/QString>
+#include <QtCore/QAtomicInt>
+#include <QtCore/QThread>
+
+
+// SCHED_FIFO priorities run from 1 to this; 0 leaves a thread's scheduling alone
+#define REALTIME_MAX_PRIORITY 99
+// Highest CPU number affinity can name, plus one
+#define REALTIME_MAX_CPUS 1024
+// Stack a real-time thread faults in before it starts work
+#define REALTIME_STACK_PREFAULT (64 * 1024)
+// Stack of every thread FireNode starts, rather than the 8 MiB default that
+// locked memory would otherwise have to cover per thread
+#define REALTIME_THREAD_STACK (512 * 1024)
+
+
+//! Where and at what priority one kind of thread runs, from the "realtime"
+//! section of the config.
+//!
+//! Nothing here is required to run: whatever the process is not allowed to
+//! do is warned about once and skipped, leaving the thread as it was.
+class RealtimePolicy : public QObject
+{
+    Q_OBJECT
+
+public:
+    RealtimePolicy(const QString name);
+
+    //! CPUs the thread may run on, none for any.
+    void set_cpus(const QList<int> &cpus);
+    //! SCHED_FIFO priority, 0 for normal scheduling.
+    void set_priority(int priority);
+    //! Faults in the thread's stack before it starts work.
+    void set_prefault_stack(bool enabled);
+
+public slots:
+    //! Applies the policy to the calling thread.  Connect a QThread's
+    //! started() here with Qt::DirectConnection to apply it to that thread.
+    void apply(void);
+
+private:
+    //! One bit per step apply() can fail at, so each is reported once
+    enum Step {
+        STEP_AFFINITY = 1 << 0,
+        STEP_PRIORITY = 1 << 1,
+    };
+
+    void warn(int step, const char *what, int error);
+
+    QString _name;
+    QList<int> _cpus;
+    int _priority;
+    bool _prefault;
+    QAtomicInt _warned;
+};
+
+
+//! Bounds thread's stack and, if policy is given, applies it as the thread starts.
+void realtime_prepare_thread(QThread *thread, RealtimePolicy *policy);
+//! Starts thread.  Warns and returns false if it could not be created.
+bool realtime_start_thread(QThread *thread, const char *name);
+
+//! Keeps every allocation from now on in the heap, never handed back to the
+//! system, so realtime_prefault_heap() can reach buffers reserved after this.
+void realtime_keep_heap(void);
+//! Faults in every heap page allocated since realtime_keep_heap().
+void realtime_prefault_heap(void);
+//! Locks every current and future page of the process into RAM.  Call it once
+//! every thread is running: thread stacks created afterwards must fit the limit.
+bool realtime_lock_memory(void);
+
+#endif
@@ -0,0 +1,102 @@
+// FireNode
+// Copyright (c) 2013 Jon Evans
+// http://craftyjon.com/projects/openlights/firenode
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#include "recording.h"
+
+#include <cstring>
+
+
+static inline void write_le(uint8_t *out, uint64_t value, int bytes)
+{
+    for (int i = 0; i < bytes; i++) {
+        out[i] = (value >> (8 * i)) & 0xFF;
+    }
+}
+
+
+static inline uint64_t read_le(const uint8_t *in, int bytes)
+{
+    uint64_t value = 0;
+    for (int i = 0; i < bytes; i++) {
+        value |= (uint64_t)in[i] << (8 * i);
+    }
+    return value;
+}
+
+
+Recorder::Recorder(const QString path) : _file(path)
+{
+    if (!_file.open(QIODevice::WriteOnly)) {
+        qWarning() << "Could not open" << path << "for recording";
+        return;
+    }
+
+    _file.write(RECORDING_MAGIC, RECORDING_MAGIC_SIZE);
+    _clock.start();
+}
+
+
+void Recorder::write(const QByteArray &datagram)
+{
+    if (!_file.isOpen()) {
+        return;
+    }
+
+    uint8_t header[RECORDING_RECORD_HEADER];
+    write_le(header, _clock.nsecsElapsed() / 1000, 8);
+    write_le(header + 8, datagram.size(), 4);
+
+    _file.write((const char *)header, RECORDING_RECORD_HEADER);
+    _file.write(datagram);
+}
+
+
+Playback::Playback(const QString path) : _file(path)
+{
+    if (!_file.open(QIODevice::ReadOnly)) {
+        qWarning() << "Could not open" << path;
+        return;
+    }
+
+    char magic[RECORDING_MAGIC_SIZE];
+    if (_file.read(magic, RECORDING_MAGIC_SIZE) != RECORDING_MAGIC_SIZE ||
+            memcmp(magic, RECORDING_MAGIC, RECORDING_MAGIC_SIZE) != 0) {
+        qWarning() << path << "is not a FireNode recording";
+        _file.close();
+    }
+}
+
+
+bool Playback::next(qint64 *timestamp_us, QByteArray *datagram)
+{
+    uint8_t header[RECORDING_RECORD_HEADER];
+
+    if (_file.read((char *)header, RECORDING_RECORD_HEADER) != RECORDING_RECORD_HEADER) {
+        return false;
+    }
+
+    *timestamp_us = read_le(header, 8);
+    int length = read_le(header + 8, 4);
+
+    *datagram = _file.read(length);
+    return datagram->size() == length;
+}
@@ -0,0 +1,72 @@
+// FireNode
+// Copyright (c) 2013 Jon Evans
+// http://craftyjon.com/projects/openlights/firenode
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#ifndef _RECORDING_H
+#define _RECORDING_H
+
+#include "portability.h"
+
+#include <QtCore/QFile>
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QDebug>
+
+
+// Recorded show: RECORDING_MAGIC, then for every datagram received
+//
+//   8    arrival time in microseconds since recording started, little endian
+//   4    datagram length, little endian
+//   n    datagram
+
+#define RECORDING_MAGIC "FNREC001"
+#define RECORDING_MAGIC_SIZE 8
+#define RECORDING_RECORD_HEADER 12
+
+
+//! Writes every datagram the node receives to a file, for benchmarks and replay.
+class Recorder
+{
+public:
+    Recorder(const QString path);
+
+    bool is_open(void) const { return _file.isOpen(); }
+    void write(const QByteArray &datagram);
+
+private:
+    QFile _file;
+    QElapsedTimer _clock;
+};
+
+
+//! Reads a show back, one datagram at a time.
+class Playback
+{
+public:
+    Playback(const QString path);
+
+    bool is_open(void) const { return _file.isOpen(); }
+    bool next(qint64 *timestamp_us, QByteArray *datagram);
+
+private:
+    QFile _file;
+};
+
+#endif
@@ -0,0 +1,196 @@
+// FireNode
+// Copyright (c) 2013 Jon Evans
+// http://craftyjon.com/projects/openlights/firenode
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+
+#include "remap.h"
+
+#include <cstring>
+
+#include <QtCore/QFile>
+#include <QtCore/QTextStream>
+#include <QtCore/QDebug>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_REMAP_AVX2
+#include <immintrin.h>
+#endif
+
+
+std::vector<int32_t> remap_serpentine(int pixels, int width)
+{
+    std::vector<int32_t> layout(pixels);
+
+    for (int i = 0; i < pixels; i++) {
+        int row = i / width;
+        int column = i % width;
+        layout[i] = (row % 2) ? row * width + (width - 1 - column) : i;
+    }
+
+    return layout;
+}
+
+
+std::vector<int32_t> remap_reversed(int pixels)
+{
+    std::vector<int32_t> layout(pixels);
+
+    for (int i = 0; i < pixels; i++) {
+        layout[i] = pixels - 1 - i;
+    }
+
+    return layout;
+}
+
+
+std::vector<int32_t> remap_offset(int pixels, int offset)
+{
+    std::vector<int32_t> layout(pixels);
+
+    for (int i = 0; i < pixels; i++) {
+        layout[i] = (i >= offset) ? i - offset : REMAP_DARK;
+    }
+
+    return layout;
+}
+
+
+bool remap_from_file(const QString path, std::vector<int32_t> *layout)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly | QIODevice::Text)) {
+        qWarning() << "Could not open remap file" << path;
+        return false;
+    }
+
+    layout->clear();
+
+    QTextStream in(&file);
+    while (!in.atEnd()) {
+        QString word;
+        in >> word;
+        if (word.isEmpty()) {
+            continue;
+        }
+
+        bool ok;
+        int index = word.toInt(&ok);
+        if (!ok) {
+            qWarning() << "Remap file" << path << "has a bad entry:" << word;
+            return false;
+        }
+        layout->push_back(index < 0 ? REMAP_DARK : index);
+    }
+
+    return true;
+}
+
+
+std::vector<int32_t> compile_remap(const std::vector<int32_t> &layout)
+{
+    std::vector<int32_t> table(layout.size());
+
+    for (size_t i = 0; i < layout.size(); i++) {
+        table[i] = (layout[i] < 0) ? REMAP_DARK : layout[i] * 3;
+    }
+
+    return table;
+}
+
+
+uint32_t remap_pixels_scalar(const uint8_t *src, int src_bytes, const int32_t *table, int pixels, const uint8_t *order, uint8_t *dst)
+{
+    uint32_t sum = 0;
+    for (int i = 0; i < pixels; i++) {
+        int32_t offset = table[i];
+
+        if (offset >= 0 && offset <= src_bytes - 3) {
+            dst[3 * i] = src[offset + order[0]];
+            dst[3 * i + 1] = src[offset + order[1]];
+            dst[3 * i + 2] = src[offset + order[2]];
+            sum += src[offset] + src[offset + 1] + src[offset + 2];
+        } else {
+            dst[3 * i] = dst[3 * i + 1] = dst[3 * i + 2] = 0;
+        }
+    }
+    return sum;
+}
+
+
+#ifdef HAVE_REMAP_AVX2
+__attribute__((target("avx2")))
+static uint32_t remap_pixels_avx2(const uint8_t *src, int src_bytes, const int32_t *table, int pixels, const uint8_t *order, uint8_t *dst)
+{
+    // Each gathered dword is one RGB pixel plus a stray byte.  This packs four
+    // of them per 128-bit lane into 12 bytes, in the output color order.
+    int8_t mask[32];
+    for (int half = 0; half < 2; half++) {
+        for (int pixel = 0; pixel < 4; pixel++) {
+            for (int channel = 0; channel < 3; channel++) {
+                mask[16 * half + 3 * pixel + channel] = 4 * pixel + order[channel];
+            }
+        }
+        memset(mask + 16 * half + 12, -1, 4);
+    }
+    const __m256i pack = _mm256_loadu_si256((const __m256i *)mask);
+    const __m256i none = _mm256_set1_epi32(-1);
+    const __m256i last = _mm256_set1_epi32(src_bytes - 3);
+    __m256i sum = _mm256_setzero_si256();
+
+    int i = 0;
+    for (; i + 8 <= pixels; i += 8) {
+        __m256i offsets = _mm256_loadu_si256((const __m256i *)(table + i));
+
+        // Only gather entries that point inside the packet; the rest stay zero
+        __m256i valid = _mm256_andnot_si256(_mm256_cmpgt_epi32(offsets, last), _mm256_cmpgt_epi32(offsets, none));
+        __m256i gathered = _mm256_mask_i32gather_epi32(_mm256_setzero_si256(), (const int *)src, offsets, valid, 1);
+        __m256i packed = _mm256_shuffle_epi8(gathered, pack);
+        sum = _mm256_add_epi64(sum, _mm256_sad_epu8(packed, _mm256_setzero_si256()));
+
+        // 24 bytes out: the low lane's 4 spare bytes are overwritten by the high lane
+        __m128i high = _mm256_extracti128_si256(packed, 1);
+        uint8_t *out = dst + 3 * i;
+        _mm_storeu_si128((__m128i *)out, _mm256_castsi256_si128(packed));
+        _mm_storel_epi64((__m128i *)(out + 12), high);
+        int32_t tail = _mm_extract_epi32(high, 2);
+        memcpy(out + 20, &tail, 4);
+    }
+
+    __m128i halves = _mm_add_epi64(_mm256_castsi256_si128(sum), _mm256_extracti128_si256(sum, 1));
+    uint32_t total = _mm_cvtsi128_si32(halves) + _mm_cvtsi128_si32(_mm_unpackhi_epi64(halves, halves));
+
+    return total + remap_pixels_scalar(src, src_bytes, table + i, pixels - i, order, dst + 3 * i);
+}
+
+static bool remap_have_avx2 = __builtin_cpu_supports("avx2");
+#endif
+
+
+uint32_t remap_pixels(const uint8_t *src, int src_bytes, const int32_t *table, int pixels, const uint8_t *order, uint8_t *dst)
+{
+#ifdef HAVE_REMAP_AVX2
+    if (remap_have_avx2) {
+        return remap_pixels_avx2(src, src_bytes, table, pixels, order, dst);
+    }
+#endif
+
+    return remap_pixels_scalar(src, src_bytes, table, pixels, order, dst);
+}
@@ -0,0 +1,66 @@
+// FireNode
+// Copyright (c) 2013 Jon Evans
+// http://craftyjon.com/projects/openlights/firenode
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+
+#ifndef _REMAP_H
+#define _REMAP_H
+
+#include "portability.h"
+
+#include <vector>
+
+#include <QtCore/QString>
+
+
+// Pixel remapping, so wiring changes do not need the sketch or FireMix.
+//
+// A layout is a list with one entry per physical pixel on the strand: the
+// index of the pixel in the incoming strand data that it shows, or -1 to
+// leave it dark.  It is compiled once into byte offsets and applied while
+// strand packets are unpacked.
+
+#define REMAP_DARK -1
+
+
+//! Every other row of width pixels runs backwards (zigzag wiring).
+std::vector<int32_t> remap_serpentine(int pixels, int width);
+//! The strand is fed from its far end.
+std::vector<int32_t> remap_reversed(int pixels);
+//! Physical pixel i shows pixel i - offset; the first offset pixels stay dark.
+std::vector<int32_t> remap_offset(int pixels, int offset);
+//! Reads whitespace separated indices from a file.  Returns false if it cannot.
+bool remap_from_file(const QString path, std::vector<int32_t> *layout);
+
+//! Turns a layout into the gather table remap_pixels() takes.
+std::vector<int32_t> compile_remap(const std::vector<int32_t> &layout);
+
+//! Gathers pixels from src (src_bytes of RGB) through table into dst
+//! (pixels * 3 bytes), putting channel order[k] in byte k of each pixel (see
+//! src/color_order.h).  Entries out of range of src come out dark.  Uses AVX2
+//! gathers when the CPU has them, which may read one byte past src_bytes:
+//! pass the tail of a QByteArray, whose terminator makes that safe.  Returns
+//! the sum of the bytes written, like a ColorOrderKernel.
+uint32_t remap_pixels(const uint8_t *src, int src_bytes, const int32_t *table, int pixels, const uint8_t *order, uint8_t *dst);
+//! Plain C++ version producing the same output.
+uint32_t remap_pixels_scalar(const uint8_t *src, int src_bytes, const int32_t *table, int pixels, const uint8_t *order, uint8_t *dst);
+
+#endif
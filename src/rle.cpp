@@ -0,0 +1,218 @@
+// FireNode
+// Copyright (c) 2013 Jon Evans
+// http://craftyjon.com/projects/openlights/firenode
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#include "rle.h"
+
+#include <cstring>
+
+#if defined(__SSE2__)
+#define HAVE_RLE_SSE2
+#include <emmintrin.h>
+#endif
+
+
+static inline bool emit_literals(const uint8_t *in, size_t count, uint8_t *out, size_t *pos, size_t capacity)
+{
+    while (count > 0) {
+        size_t chunk = (count > RLE_MAX_LITERAL) ? RLE_MAX_LITERAL : count;
+
+        if (*pos + 1 + chunk > capacity) {
+            return false;
+        }
+
+        out[(*pos)++] = (uint8_t)(chunk - 1);
+        memcpy(out + *pos, in, chunk);
+        *pos += chunk;
+
+        in += chunk;
+        count -= chunk;
+    }
+
+    return true;
+}
+
+
+static inline bool emit_run(uint8_t value, size_t run, uint8_t *out, size_t *pos, size_t capacity)
+{
+    if (*pos + 2 > capacity) {
+        return false;
+    }
+
+    out[(*pos)++] = (uint8_t)(128 + run - RLE_MIN_RUN);
+    out[(*pos)++] = value;
+
+    return true;
+}
+
+
+//! First j >= i where in[j] == in[j + 1] == in[j + 2], or len if there is none.
+static inline size_t find_run_scalar(const uint8_t *in, size_t i, size_t len)
+{
+    for (; i + 2 < len; i++) {
+        if (in[i] == in[i + 1] && in[i] == in[i + 2]) {
+            return i;
+        }
+    }
+    return len;
+}
+
+
+//! Length of the run of in[i] starting at i, at most RLE_MAX_RUN.
+static inline size_t run_length_scalar(const uint8_t *in, size_t i, size_t len)
+{
+    size_t run = 1;
+    while (i + run < len && run < RLE_MAX_RUN && in[i + run] == in[i]) {
+        run++;
+    }
+    return run;
+}
+
+
+#ifdef HAVE_RLE_SSE2
+static inline size_t find_run_sse2(const uint8_t *in, size_t i, size_t len)
+{
+    // Compare each byte with its two successors, 16 positions at a time
+    while (i + 18 <= len) {
+        __m128i a = _mm_loadu_si128((const __m128i *)(in + i));
+        __m128i b = _mm_loadu_si128((const __m128i *)(in + i + 1));
+        __m128i c = _mm_loadu_si128((const __m128i *)(in + i + 2));
+
+        int mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, b), _mm_cmpeq_epi8(a, c)));
+        if (mask != 0) {
+            return i + __builtin_ctz(mask);
+        }
+        i += 16;
+    }
+
+    return find_run_scalar(in, i, len);
+}
+
+
+static inline size_t run_length_sse2(const uint8_t *in, size_t i, size_t len)
+{
+    __m128i value = _mm_set1_epi8(in[i]);
+    size_t run = 1;
+
+    while (run < RLE_MAX_RUN && i + run + 16 <= len) {
+        __m128i next = _mm_loadu_si128((const __m128i *)(in + i + run));
+        int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(next, value));
+
+        if (mask != 0xFFFF) {
+            run += __builtin_ctz(~mask);
+            return (run > RLE_MAX_RUN) ? RLE_MAX_RUN : run;
+        }
+        run += 16;
+    }
+
+    if (run >= RLE_MAX_RUN) {
+        return RLE_MAX_RUN;
+    }
+
+    while (i + run < len && run < RLE_MAX_RUN && in[i + run] == in[i]) {
+        run++;
+    }
+    return run;
+}
+#endif
+
+
+size_t rle_encode_scalar(const uint8_t *in, size_t len, uint8_t *out, size_t capacity)
+{
+    size_t i = 0, pos = 0;
+
+    while (i < len) {
+        size_t run_start = find_run_scalar(in, i, len);
+
+        if (!emit_literals(in + i, run_start - i, out, &pos, capacity)) {
+            return 0;
+        }
+        if (run_start == len) {
+            break;
+        }
+
+        size_t run = run_length_scalar(in, run_start, len);
+        if (!emit_run(in[run_start], run, out, &pos, capacity)) {
+            return 0;
+        }
+        i = run_start + run;
+    }
+
+    return pos;
+}
+
+
+size_t rle_encode(const uint8_t *in, size_t len, uint8_t *out, size_t capacity)
+{
+#ifdef HAVE_RLE_SSE2
+    size_t i = 0, pos = 0;
+
+    while (i < len) {
+        size_t run_start = find_run_sse2(in, i, len);
+
+        if (!emit_literals(in + i, run_start - i, out, &pos, capacity)) {
+            return 0;
+        }
+        if (run_start == len) {
+            break;
+        }
+
+        size_t run = run_length_sse2(in, run_start, len);
+        if (!emit_run(in[run_start], run, out, &pos, capacity)) {
+            return 0;
+        }
+        i = run_start + run;
+    }
+
+    return pos;
+#else
+    return rle_encode_scalar(in, len, out, capacity);
+#endif
+}
+
+
+size_t rle_decode(const uint8_t *in, size_t len, uint8_t *out, size_t capacity)
+{
+    size_t i = 0, pos = 0;
+
+    while (i < len) {
+        uint8_t control = in[i++];
+
+        if (control < 128) {
+            size_t count = control + 1;
+            if (count > len - i || count > capacity - pos) {
+                return 0;
+            }
+            memcpy(out + pos, in + i, count);
+            i += count;
+            pos += count;
+        } else {
+            size_t count = control - 128 + RLE_MIN_RUN;
+            if (i >= len || count > capacity - pos) {
+                return 0;
+            }
+            memset(out + pos, in[i++], count);
+            pos += count;
+        }
+    }
+
+    return pos;
+}
@@ -0,0 +1,57 @@
+// FireNode
+// Copyright (c) 2013 Jon Evans
+// http://craftyjon.com/projects/openlights/firenode
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#ifndef _RLE_H
+#define _RLE_H
+
+#include "portability.h"
+
+#include <cstddef>
+
+
+// Byte run-length encoding for the serial link, cheap enough for the Teensy to
+// decode as the frame comes in.  Each control byte c is followed by either:
+//
+//   c < 128    c + 1 literal bytes
+//   c >= 128   one byte, repeated c - 128 + RLE_MIN_RUN times
+//
+// The transposed bit-plane buffer is mostly long runs of 0x00 and 0xFF on dark
+// or uniform content, which this handles well.
+
+#define RLE_MIN_RUN 3
+#define RLE_MAX_RUN (127 + RLE_MIN_RUN)
+#define RLE_MAX_LITERAL 128
+
+//! Worst-case encoded size of len input bytes.
+#define RLE_MAX_ENCODED(len) ((len) + ((len) + RLE_MAX_LITERAL - 1) / RLE_MAX_LITERAL)
+
+
+//! Encodes in to out.  Returns the encoded size, or 0 if it would not fit in
+//! capacity bytes.  Uses SSE2 to find run boundaries where available.
+size_t rle_encode(const uint8_t *in, size_t len, uint8_t *out, size_t capacity);
+//! Plain C++ encoder producing the same output, for reference and benchmarks.
+size_t rle_encode_scalar(const uint8_t *in, size_t len, uint8_t *out, size_t capacity);
+//! Host-side reference decoder.  Returns the decoded size, or 0 if the input
+//! is malformed or would overflow capacity.
+size_t rle_decode(const uint8_t *in, size_t len, uint8_t *out, size_t capacity);
+
+#endif
@@ -24,17 +24,28 @@
 
 
 Serial::Serial(const QString name)
+    : _alloc_check("serial")
 {
     //QSerialPortInfo info = QSerialPortInfo(name);
     _packets = 0;
     _port_name = name;
     _timer = 0;
+    _open = false;
+    _managed = false;
+    _present = false;
+    _last_open_attempt.start();
 
-    open_port();
+    connect(&_port, SIGNAL(readyRead()), this, SLOT(read_replies()));
+
+    if (!_port_name.isEmpty()) {
+        open_port();
+    }
 
     _exit = false;
     _packet_in_process = false;
     _pending_write = false;
+    _frame_sync = false;
+    _held = false;
 }
 
 
@@ -48,6 +59,7 @@ bool Serial::open_port()
 {
     bool success = true;
 
+    _last_open_attempt.start();
     _port.close();
     _port.setPortName(_port_name);
 
@@ -93,6 +105,67 @@ void Serial::packet_done()
 }
 
 
+void Serial::set_frame_sync(bool enabled)
+{
+    _frame_sync = enabled;
+}
+
+
+bool Serial::holding_frame()
+{
+    return _held;
+}
+
+
+bool Serial::release_frame()
+{
+    if (!_held) {
+        return false;
+    }
+
+    _held = false;
+
+    if (!write_segments(_frame.view(_frame.size() - 1))) {
+        qDebug() << "Write error";
+        return false;
+    }
+    _port.flush();
+
+    return true;
+}
+
+
+void Serial::read_replies()
+{
+    QByteArray replies = _port.readAll();
+    parse_replies(replies.constData(), replies.length());
+}
+
+
+void Serial::device_added(const QString path)
+{
+    _managed = true;
+    _present = true;
+    _port_name = path;
+    _open = false;
+    _held = false;
+
+    if (open_port()) {
+        qDebug() << "Opened" << _port_name;
+    }
+}
+
+
+void Serial::device_removed()
+{
+    _managed = true;
+    _present = false;
+    _port.close();
+    _open = false;
+    _held = false;
+}
+
+
 void Serial::shutdown()
 {
     _exit = true;
@@ -100,43 +173,70 @@ void Serial::shutdown()
     _timer->deleteLater();
 }
 
-void Serial::update_data(QByteArray *data)
+void Serial::reserve(int bytes)
+{
+    // Swapped with the queued frames, so it needs the same room
+    Output::reserve(bytes);
+    _frame.reserve(bytes);
+}
+
+bool Serial::write_segments(const OutputFrame &frame)
 {
-    _next_frame = *data;
+    // QSerialPort queues each piece, so the frame is never joined up first
+    for (int i = 0; i < FRAME_SEGMENTS; i++) {
+        if (frame.length[i] > 0 && _port.write(frame.data[i], frame.length[i]) < 0) {
+            return false;
+        }
+    }
+    return true;
 }
 
 void Serial::write_data()
 {
     //char reply[256];
 
+    // Still waiting on the sync group to release the last frame
+    if (_held) {
+        return;
+    }
+
     if (!_open) {
-        if (!open_port()) {
+        // A managed port stays closed until hotplug sees the device, then
+        // keeps retrying in case it was not ready when it first appeared
+        if (_managed && !_present) {
+            return;
+        }
+        if (_last_open_attempt.elapsed() < SERIAL_REOPEN_INTERVAL_MS || !open_port()) {
             return;
         }
     }
 
-    //_frame = QByteArray::fromRawData(_next_frame.data(), _next_frame.length());
-    _frame = _next_frame;
+    // QSerialPort's own write buffering counts too, the tty backend avoids it
+    TrackAllocations tracking;
+
+    // Without a new frame the last one goes out again
+    next_frame(&_frame);
     //qDebug() << _frame.toHex().left(16);
 
-    if (_frame.length() == 0) {
+    if (_frame.is_empty()) {
         return;
     }
 
-    int rc = _port.write(_frame);
-    if (rc < 0) {
+    // In frame-sync mode the last byte waits for SyncGroup::commit()
+    if (!write_segments(_frame.view(0, _frame.size() - (_frame_sync ? 1 : 0)))) {
+        IgnoreAllocations ignore;
         qDebug() << "Write error";
     }
-#if 0
-    else {
-        qDebug("wrote %d bytes", rc);
-    }
-#endif
 
     if (!_port.waitForBytesWritten(100)) {
+        IgnoreAllocations ignore;
         qDebug() << "Timeout!";
-        _open = false;
-        // Probably teensy power was pulled.  Let's try reopening the port.
+        if (!_managed) {
+            _open = false;
+            // Probably teensy power was pulled.  Let's try reopening the port.
+        }
+    } else if (_frame_sync) {
+        _held = true;
     }
 #if 0
     if (_port.waitForReadyRead(1000)) {
@@ -145,6 +245,7 @@ void Serial::write_data()
     }
 #endif
     _packets++;
+    _alloc_check.frame_done();
 
     //_port.flush();
 }
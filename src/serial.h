@@ -24,6 +24,7 @@
 #define _SERIAL_H
 
 #include "portability.h"
+#include "output.h"
 
 #include <QtCore/QObject>
 #include <QtCore/QThread>
@@ -32,13 +33,15 @@
 #include <QtSerialPort/QSerialPortInfo>
 #include <QtCore/QQueue>
 #include <QtCore/QTimer>
+#include <QtCore/QElapsedTimer>
 
 
 #define STATS_TIME 1.0
+#define SERIAL_REOPEN_INTERVAL_MS 1000
 
 
 //! Writes data to strand controller connected to a virtual serial port.
-class Serial : public QObject
+class Serial : public Output
 {
     Q_OBJECT
 
@@ -48,8 +51,15 @@ public:
     //unsigned long long get_pps_and_reset(void);
     void run(void);
 
+    void set_frame_sync(bool enabled);
+    bool holding_frame(void);
+    bool release_frame(void);
+    void reserve(int bytes);
+
+    void device_added(const QString path);
+    void device_removed(void);
+
 public slots:
-    void update_data(QByteArray *data);
     void write_data(void);
     //void enqueue_data(QByteArray *data, bool force=false);
     //void print_stats(void);
@@ -61,8 +71,12 @@ public slots:
 signals:
     void data_written(); 
 
+private slots:
+    void read_replies(void);
+
 private:
     bool open_port(void);
+    bool write_segments(const OutputFrame &frame);
 
     QString _port_name;
     QSerialPort _port;
@@ -70,12 +84,17 @@ private:
     QTimer *_timer;
     bool _packet_in_process;
     bool _pending_write;
+    bool _frame_sync;
+    bool _held;
+    bool _managed;
+    bool _present;
+    QElapsedTimer _last_open_attempt;
 
     unsigned long long _packets;
     bool _exit;
     QQueue<QByteArray> _q;
-    QByteArray _frame;
-    QByteArray _next_frame;
+    FrameBuffer _frame;
+    AllocationCheck _alloc_check;
 
     QByteArray _packet_start_frame, _packet_end_frame;
 
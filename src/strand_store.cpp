@@ -0,0 +1,92 @@
+// FireNode
+// Copyright (c) 2013 Jon Evans
+// http://craftyjon.com/projects/openlights/firenode
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+
+#include "strand_store.h"
+
+#include <cstring>
+
+
+StrandStore::StrandStore()
+{
+    _base = NULL;
+}
+
+
+int StrandStore::add_region(int count)
+{
+    Region region;
+    region.count = count;
+    region.length = 0;
+    region.stride = 0;
+    region.offset = 0;
+
+    _regions.push_back(region);
+    return _regions.size() - 1;
+}
+
+
+void StrandStore::resize_region(int index, int length)
+{
+    std::vector<Region> regions = _regions;
+    Region &resized = regions[index];
+    resized.length = length;
+    resized.stride = (length + STRAND_STORE_ALIGN - 1) / STRAND_STORE_ALIGN * STRAND_STORE_ALIGN;
+
+    size_t size = 0;
+    for (size_t i = 0; i < regions.size(); i++) {
+        regions[i].offset = size;
+        size += (size_t)regions[i].count * regions[i].stride;
+    }
+
+    // Zeroed, so everything not copied over below starts dark
+    std::vector<uint8_t> block(size + STRAND_STORE_ALIGN, 0);
+    uint8_t *base = block.data() + (STRAND_STORE_ALIGN - (uintptr_t)block.data() % STRAND_STORE_ALIGN) % STRAND_STORE_ALIGN;
+
+    for (size_t i = 0; i < regions.size(); i++) {
+        const Region &from = _regions[i];
+        const Region &to = regions[i];
+        int keep = (from.length < to.length) ? from.length : to.length;
+
+        for (int strand = 0; strand < to.count && keep > 0; strand++) {
+            memcpy(base + to.offset + (size_t)strand * to.stride, _base + from.offset + (size_t)strand * from.stride, keep);
+        }
+    }
+
+    _regions.swap(regions);
+    _block.swap(block);
+    _base = base;
+}
+
+
+StrandView StrandStore::view(int index) const
+{
+    const Region &region = _regions[index];
+
+    StrandView view;
+    view.data = _base + region.offset;
+    view.stride = region.stride;
+    view.count = region.count;
+    view.length = region.length;
+    view.width = 1;
+    return view;
+}
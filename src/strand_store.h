@@ -0,0 +1,81 @@
+// FireNode
+// Copyright (c) 2013 Jon Evans
+// http://craftyjon.com/projects/openlights/firenode
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+
+#ifndef _STRAND_STORE_H
+#define _STRAND_STORE_H
+
+#include "portability.h"
+
+#include <cstddef>
+#include <vector>
+
+
+// Strands start on cache line boundaries
+#define STRAND_STORE_ALIGN 64
+
+
+//! count strands of length bytes each, stride bytes apart.
+struct StrandView
+{
+    uint8_t *data;
+    int stride;
+    int count;
+    int length;
+    int width;      // Bytes per channel: 1, or 2 for 16-bit channels (src/high_depth.h)
+
+    uint8_t *strand(int index) const { return data + (size_t)index * stride; }
+};
+
+
+//! Strand buffers of many outputs in one cache-line aligned block.
+//!
+//! Each output gets a region holding its strands back to back, every strand
+//! padded to whole cache lines, instead of one heap block per strand.  Regions
+//! are added and sized from the config at startup.  Growing one later (an
+//! output without "strand-lengths" seeing a longer strand) lays the block out
+//! again, which invalidates every view taken before.
+class StrandStore
+{
+public:
+    StrandStore();
+
+    //! Adds a region of count empty strands.  Returns its index.
+    int add_region(int count);
+    //! Sets the strands of region to length bytes.  Bytes past their old length are zero.
+    void resize_region(int region, int length);
+    StrandView view(int region) const;
+
+private:
+    struct Region {
+        int count;
+        int length;
+        int stride;
+        size_t offset;
+    };
+
+    std::vector<Region> _regions;
+    std::vector<uint8_t> _block;
+    uint8_t *_base;
+};
+
+#endif
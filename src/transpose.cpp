@@ -0,0 +1,119 @@
+// FireNode
+// Copyright (c) 2013 Jon Evans
+// http://craftyjon.com/projects/openlights/firenode
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+
+#include "transpose.h"
+
+#if defined(__SSE2__)
+#define HAVE_TRANSPOSE_SSE2
+#include <emmintrin.h>
+#endif
+
+
+// Transposes 8 lanes of 8 bits.  Afterwards byte b holds bit b of every lane,
+// so plane k (bit 7 - k) is byte 7 - k.  Hacker's Delight, transpose8.
+static inline uint64_t transpose8x8(const uint8_t *values)
+{
+    uint64_t x = 0;
+    for (int lane = 0; lane < 8; lane++) {
+        x |= (uint64_t)values[lane] << (8 * lane);
+    }
+
+    uint64_t t;
+    t = (x ^ (x >> 7)) & 0x00AA00AA00AA00AAULL;
+    x = x ^ t ^ (t << 7);
+    t = (x ^ (x >> 14)) & 0x0000CCCC0000CCCCULL;
+    x = x ^ t ^ (t << 14);
+    t = (x ^ (x >> 28)) & 0x00000000F0F0F0F0ULL;
+    x = x ^ t ^ (t << 28);
+
+    return x;
+}
+
+
+template <>
+void transpose_planes<8>(const uint8_t *values, int planes, uint8_t *out)
+{
+    uint64_t x = transpose8x8(values);
+
+    for (int plane = 0; plane < planes; plane++) {
+        out[plane] = (x >> (8 * (7 - plane))) & 0xFF;
+    }
+}
+
+
+#ifndef HAVE_TRANSPOSE_SSE2
+// Lane groups of 8 land in consecutive bytes of each little endian plane word
+static inline void transpose_groups(const uint8_t *values, int groups, int planes, uint8_t *out)
+{
+    for (int group = 0; group < groups; group++) {
+        uint64_t x = transpose8x8(values + 8 * group);
+
+        for (int plane = 0; plane < planes; plane++) {
+            out[plane * groups + group] = (x >> (8 * (7 - plane))) & 0xFF;
+        }
+    }
+}
+#endif
+
+
+template <>
+void transpose_planes<16>(const uint8_t *values, int planes, uint8_t *out)
+{
+#ifdef HAVE_TRANSPOSE_SSE2
+    // movemask collects the top bit of every byte; adding a vector to itself
+    // shifts each byte left to bring up the next plane
+    __m128i v = _mm_loadu_si128((const __m128i *)values);
+
+    for (int plane = 0; plane < planes; plane++) {
+        int mask = _mm_movemask_epi8(v);
+        out[2 * plane] = mask & 0xFF;
+        out[2 * plane + 1] = (mask >> 8) & 0xFF;
+        v = _mm_add_epi8(v, v);
+    }
+#else
+    transpose_groups(values, 2, planes, out);
+#endif
+}
+
+
+template <>
+void transpose_planes<32>(const uint8_t *values, int planes, uint8_t *out)
+{
+#ifdef HAVE_TRANSPOSE_SSE2
+    __m128i lo = _mm_loadu_si128((const __m128i *)values);
+    __m128i hi = _mm_loadu_si128((const __m128i *)(values + 16));
+
+    for (int plane = 0; plane < planes; plane++) {
+        int mask_lo = _mm_movemask_epi8(lo);
+        int mask_hi = _mm_movemask_epi8(hi);
+        out[4 * plane] = mask_lo & 0xFF;
+        out[4 * plane + 1] = (mask_lo >> 8) & 0xFF;
+        out[4 * plane + 2] = mask_hi & 0xFF;
+        out[4 * plane + 3] = (mask_hi >> 8) & 0xFF;
+        lo = _mm_add_epi8(lo, lo);
+        hi = _mm_add_epi8(hi, hi);
+    }
+#else
+    transpose_groups(values, 4, planes, out);
+#endif
+}
@@ -0,0 +1,53 @@
+// FireNode
+// Copyright (c) 2013 Jon Evans
+// http://craftyjon.com/projects/openlights/firenode
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+
+#ifndef _TRANSPOSE_H
+#define _TRANSPOSE_H
+
+#include "portability.h"
+
+
+// Lanes are the strands a controller drives in parallel.  Every channel byte
+// becomes bit planes, most significant first, and each plane is one word with
+// lane i in bit i: a byte for 8 lanes, 16 or 32 bits (little endian) for the
+// wider controllers.
+
+#define LANES_DEFAULT 8
+
+
+//! Writes the top planes bit planes of LANES lane values to out
+//! (planes * LANES / 8 bytes).
+template <int LANES>
+void transpose_planes(const uint8_t *values, int planes, uint8_t *out);
+
+//! 8x8 bit matrix transpose on a 64-bit word, portable.
+template <>
+void transpose_planes<8>(const uint8_t *values, int planes, uint8_t *out);
+//! One SSE2 movemask per plane, or two 8x8 transposes without SSE2.
+template <>
+void transpose_planes<16>(const uint8_t *values, int planes, uint8_t *out);
+//! Two SSE2 movemasks per plane, or four 8x8 transposes without SSE2.
+template <>
+void transpose_planes<32>(const uint8_t *values, int planes, uint8_t *out);
+
+#endif
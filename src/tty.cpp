@@ -0,0 +1,546 @@
+// FireNode
+// Copyright (c) 2013 Jon Evans
+// http://craftyjon.com/projects/openlights/firenode
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#include "tty.h"
+
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include <sys/uio.h>
+
+
+TtyWriter::TtyWriter()
+    : _alloc_check("tty writer")
+{
+    _exit = 0;
+    _sync = NULL;
+    _arrived = false;
+    _releasing = false;
+    _ticket = 0;
+    _arrived_at = 0;
+    _deadline = 0;
+
+    _epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    _wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+    if (_epoll_fd < 0 || _wake_fd < 0) {
+        qWarning("Could not set up tty writer: %s", strerror(errno));
+        return;
+    }
+
+    // A NULL data pointer marks the wakeup event
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.ptr = NULL;
+    epoll_ctl(_epoll_fd, EPOLL_CTL_ADD, _wake_fd, &ev);
+}
+
+
+TtyWriter::~TtyWriter()
+{
+    stop();
+    wait();
+
+    for (int i = 0; i < _ports.size(); i++) {
+        close_port(_ports[i]);
+        delete _ports[i];
+    }
+
+    if (_wake_fd >= 0) { ::close(_wake_fd); }
+    if (_epoll_fd >= 0) { ::close(_epoll_fd); }
+}
+
+
+TtyPort *TtyWriter::add_port(Output *owner, const QString name, int sync_id)
+{
+    TtyPort *port = new TtyPort;
+    port->owner = owner;
+    port->name = name;
+    port->sync_id = sync_id;
+    port->fd = -1;
+    port->want_write = false;
+    port->offset = 0;
+    port->busy = false;
+    port->held = false;
+    port->released = false;
+    port->frames = 0;
+    port->managed = false;
+    port->present = false;
+    port->reattach = false;
+
+    port->last_open_attempt.start();
+    port->stats_timer.start();
+    if (!name.isEmpty()) {
+        open_port(port);
+    }
+
+    QMutexLocker locker(&_ports_lock);
+    _ports.append(port);
+
+    return port;
+}
+
+
+void TtyWriter::set_frame_sync(FrameSync *sync)
+{
+    _sync = sync;
+    _sync->add_participant();
+}
+
+
+void TtyWriter::wake()
+{
+    uint64_t one = 1;
+    if (::write(_wake_fd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+        qDebug() << "Could not wake tty writer:" << strerror(errno);
+    }
+}
+
+
+void TtyWriter::stop()
+{
+    _exit = 1;
+    wake();
+}
+
+
+bool TtyWriter::open_port(TtyPort *port)
+{
+    port->last_open_attempt.start();
+
+    port->fd = ::open(port->name.toLocal8Bit().constData(), O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+    if (port->fd < 0) {
+        qDebug() << "Could not open port" << port->name << strerror(errno);
+        return false;
+    }
+
+    struct termios tio;
+    if (tcgetattr(port->fd, &tio) < 0) {
+        qDebug() << "Could not get attributes for" << port->name << strerror(errno);
+        close_port(port);
+        return false;
+    }
+
+    cfmakeraw(&tio);
+    cfsetispeed(&tio, TTY_BAUD_RATE);
+    cfsetospeed(&tio, TTY_BAUD_RATE);
+    tio.c_cflag |= (CLOCAL | CREAD);
+    tio.c_cflag &= ~CRTSCTS;
+    tio.c_cc[VMIN] = 0;
+    tio.c_cc[VTIME] = 0;
+
+    if (tcsetattr(port->fd, TCSANOW, &tio) < 0) {
+        qDebug() << "Error setting up port" << port->name << strerror(errno);
+        close_port(port);
+        return false;
+    }
+
+    tcflush(port->fd, TCIOFLUSH);
+
+    // Edge-triggered: we write until EAGAIN, then wait to be told the port drained.
+    // Replies from the receiver (protocol v2 acks) come in the same way.
+    struct epoll_event ev;
+    ev.events = EPOLLIN | EPOLLOUT | EPOLLET;
+    ev.data.ptr = port;
+    if (epoll_ctl(_epoll_fd, EPOLL_CTL_ADD, port->fd, &ev) < 0) {
+        qDebug() << "Could not watch port" << port->name << strerror(errno);
+        close_port(port);
+        return false;
+    }
+
+    port->offset = 0;
+    port->busy = false;
+    port->held = false;
+    port->released = false;
+
+    return true;
+}
+
+
+void TtyWriter::close_port(TtyPort *port)
+{
+    if (port->fd < 0) {
+        return;
+    }
+
+    epoll_ctl(_epoll_fd, EPOLL_CTL_DEL, port->fd, NULL);
+    ::close(port->fd);
+    port->fd = -1;
+    port->busy = false;
+    port->held = false;
+    port->released = false;
+    port->offset = 0;
+}
+
+
+bool TtyWriter::start_frame(TtyPort *port)
+{
+    TrackAllocations tracking;
+
+    port->lock.lock();
+    if (!port->want_write) {
+        port->lock.unlock();
+        return false;
+    }
+    port->want_write = false;
+    port->lock.unlock();
+
+    // Keep resending the last frame until a newer one shows up
+    port->owner->next_frame(&port->active);
+
+    if (port->active.is_empty()) {
+        return false;
+    }
+
+    port->offset = 0;
+    port->busy = true;
+
+    return true;
+}
+
+
+void TtyWriter::flush_port(TtyPort *port)
+{
+    TrackAllocations tracking;
+
+    while (port->busy) {
+        // In frame-sync mode the last byte waits for commit_frame()
+        int end = port->active.size() - ((_sync != NULL && !port->released) ? 1 : 0);
+
+        if (port->offset >= end) {
+            port->held = true;
+            return;
+        }
+
+        // Header, payload and trailer go out in one call, each from its own buffer
+        OutputFrame frame = port->active.view(port->offset, end);
+        struct iovec iov[FRAME_SEGMENTS];
+        for (int i = 0; i < FRAME_SEGMENTS; i++) {
+            iov[i].iov_base = (void *)frame.data[i];
+            iov[i].iov_len = frame.length[i];
+        }
+
+        ssize_t rc = ::writev(port->fd, iov, FRAME_SEGMENTS);
+
+        if (rc < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return;
+            }
+
+            // Probably teensy power was pulled.  Reopen on a later pass.
+            IgnoreAllocations ignore;
+            qDebug() << "Write error on" << port->name << strerror(errno);
+            close_port(port);
+            return;
+        }
+
+        port->offset += rc;
+
+        if (port->offset >= port->active.size()) {
+            port->busy = false;
+            port->frames++;
+            _alloc_check.frame_done();
+            if (port->frames % TTY_STATS_FRAMES == 0) {
+                print_stats(port);
+            }
+
+            // Leave the next frame to the main loop so every held byte goes out first
+            if (port->released) {
+                _sync->report(port->sync_id, _sync->now() - _deadline);
+                port->released = false;
+                return;
+            }
+
+            if (!start_frame(port)) {
+                return;
+            }
+        }
+    }
+}
+
+
+void TtyWriter::print_stats(TtyPort *port)
+{
+    IgnoreAllocations ignore;
+    qint64 elapsed = port->stats_timer.restart();
+    qDebug("Tty %s: %llu frames written, %.1f frames/sec", port->name.toLocal8Bit().constData(),
+           port->frames, elapsed > 0 ? TTY_STATS_FRAMES * 1000.0 / elapsed : 0.0);
+}
+
+
+void TtyWriter::read_port(TtyPort *port)
+{
+    char buffer[256];
+
+    for (;;) {
+        ssize_t rc = ::read(port->fd, buffer, sizeof(buffer));
+
+        if (rc > 0) {
+            port->owner->parse_replies(buffer, rc);
+            continue;
+        }
+        if (rc < 0 && errno == EINTR) {
+            continue;
+        }
+        return;
+    }
+}
+
+
+bool TtyWriter::commit_frame()
+{
+    // run() has already waited out the deadline, outside the ports lock
+    if (_releasing) {
+        _releasing = false;
+
+        for (int i = 0; i < _ports.size(); i++) {
+            TtyPort *port = _ports[i];
+
+            if (port->held) {
+                port->held = false;
+                port->released = true;
+                flush_port(port);
+            }
+        }
+        return false;
+    }
+
+    if (_arrived) {
+        if (_sync->released(_ticket, _arrived_at, &_deadline)) {
+            _arrived = false;
+            _releasing = true;
+        }
+        return true;
+    }
+
+    // Wait until every port with a frame in progress has written all but its last byte
+    bool any_held = false;
+    bool all_held = true;
+    bool drained = true;
+
+    for (int i = 0; i < _ports.size(); i++) {
+        TtyPort *port = _ports[i];
+
+        if (port->fd < 0 || !port->busy) {
+            continue;
+        }
+        if (!port->held) {
+            all_held = false;
+            continue;
+        }
+
+        any_held = true;
+
+        int queued = 0;
+        if (ioctl(port->fd, TIOCOUTQ, &queued) == 0 && queued > 0) {
+            drained = false;
+        }
+    }
+
+    if (!any_held) {
+        return false;
+    }
+
+    // Give the kernel a moment to empty its queues so the held bytes go straight out,
+    // but never let one stuck port hold everyone else forever.
+    if (!_hold_timer.isValid()) {
+        _hold_timer.start();
+    }
+
+    bool ready = all_held && (drained || _hold_timer.hasExpired(FRAME_SYNC_DRAIN_TIMEOUT_MS));
+    if (!ready && !_hold_timer.hasExpired(FRAME_SYNC_TIMEOUT_MS)) {
+        return true;
+    }
+    _hold_timer.invalidate();
+
+    _arrived_at = _sync->now();
+    _ticket = _sync->arrive_async();
+    _arrived = true;
+
+    // Last to arrive releases straight away
+    if (_sync->released(_ticket, _arrived_at, &_deadline)) {
+        _arrived = false;
+        _releasing = true;
+    }
+    return true;
+}
+
+
+void TtyWriter::run()
+{
+    struct epoll_event events[TTY_MAX_EVENTS];
+
+    while (!_exit.load()) {
+        bool any_closed = false;
+
+        bool draining = false;
+
+        // At most the release margin away, and nobody waits on the ports lock meanwhile
+        if (_releasing) {
+            _sync->wait_until(_deadline);
+        }
+
+        _ports_lock.lock();
+        if (_sync != NULL) {
+            draining = commit_frame();
+        }
+
+        for (int i = 0; i < _ports.size(); i++) {
+            TtyPort *port = _ports[i];
+
+            port->lock.lock();
+            bool managed = port->managed;
+            bool present = port->present;
+            bool reattach = port->reattach;
+            if (reattach) {
+                port->name = port->next_name;
+                port->reattach = false;
+            }
+            port->lock.unlock();
+
+            if (reattach) {
+                close_port(port);
+                if (present) {
+                    open_port(port);
+                }
+            }
+
+            if (managed && !present) {
+                continue;
+            }
+
+            if (port->fd < 0) {
+                if (port->last_open_attempt.elapsed() < TTY_REOPEN_INTERVAL_MS || !open_port(port)) {
+                    any_closed = true;
+                    continue;
+                }
+            }
+
+            if (!port->busy && start_frame(port)) {
+                flush_port(port);
+            }
+        }
+        _ports_lock.unlock();
+
+        int timeout = -1;
+        if (_arrived || _releasing) {
+            // Polling FrameSync for the release, which lands only the margin before its deadline
+            timeout = 0;
+        } else if (draining) {
+            timeout = 1;
+        } else if (any_closed) {
+            timeout = TTY_REOPEN_INTERVAL_MS;
+        }
+
+        int n = epoll_wait(_epoll_fd, events, TTY_MAX_EVENTS, timeout);
+        if (n < 0 && errno != EINTR) {
+            qWarning("epoll_wait failed: %s", strerror(errno));
+            break;
+        }
+
+        for (int i = 0; i < n; i++) {
+            TtyPort *port = (TtyPort *)events[i].data.ptr;
+
+            if (port == NULL) {
+                uint64_t count;
+                while (::read(_wake_fd, &count, sizeof(count)) > 0) {}
+                continue;
+            }
+
+            if (events[i].events & (EPOLLERR | EPOLLHUP)) {
+                qDebug() << "Lost port" << port->name;
+                close_port(port);
+                continue;
+            }
+
+            if (events[i].events & EPOLLIN) {
+                read_port(port);
+            }
+            if (events[i].events & EPOLLOUT) {
+                flush_port(port);
+            }
+        }
+    }
+}
+
+
+TtySerial::TtySerial(const QString name, TtyWriter *writer, int sync_id)
+{
+    _writer = writer;
+    _port = _writer->add_port(this, name, sync_id);
+}
+
+
+TtySerial::~TtySerial()
+{
+}
+
+
+void TtySerial::reserve(int bytes)
+{
+    // The writer swaps its frame with the queued ones, so it needs the same room
+    Output::reserve(bytes);
+    QMutexLocker locker(&_port->lock);
+    _port->active.reserve(bytes);
+}
+
+
+void TtySerial::device_added(const QString path)
+{
+    _port->lock.lock();
+    _port->managed = true;
+    _port->present = true;
+    _port->reattach = true;
+    _port->next_name = path;
+    _port->lock.unlock();
+
+    _writer->wake();
+}
+
+
+void TtySerial::device_removed()
+{
+    _port->lock.lock();
+    _port->managed = true;
+    _port->present = false;
+    _port->reattach = true;
+    _port->lock.unlock();
+
+    _writer->wake();
+}
+
+
+void TtySerial::write_data()
+{
+    _port->lock.lock();
+    _port->want_write = true;
+    _port->lock.unlock();
+
+    _writer->wake();
+}
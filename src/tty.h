@@ -0,0 +1,145 @@
+// FireNode
+// Copyright (c) 2013 Jon Evans
+// http://craftyjon.com/projects/openlights/firenode
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#ifndef _TTY_H
+#define _TTY_H
+
+#include "portability.h"
+#include "output.h"
+#include "frame_sync.h"
+
+#include <QtCore/QObject>
+#include <QtCore/QThread>
+#include <QtCore/QDebug>
+#include <QtCore/QMutex>
+#include <QtCore/QList>
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QAtomicInt>
+
+#include <termios.h>
+
+
+#define TTY_BAUD_RATE B1000000
+#define TTY_MAX_EVENTS 64
+#define TTY_REOPEN_INTERVAL_MS 1000
+#define TTY_STATS_FRAMES 1000
+
+
+//! State for one tty driven by the TtyWriter.
+struct TtyPort
+{
+    Output *owner;
+    QString name;
+    int fd;
+
+    // Shared with the owning TtySerial, guarded by lock
+    QMutex lock;
+    bool want_write;
+    bool managed;           // Hotplug opens and closes this port, never retry on our own
+    bool present;
+    bool reattach;
+    QString next_name;
+
+    // Only touched by the writer thread
+    FrameBuffer active;
+    int offset;
+    bool busy;
+    bool held;              // Frame sync: all but the last byte written
+    bool released;          // Frame sync: last byte may go out now
+    int sync_id;
+    QElapsedTimer last_open_attempt;
+    QElapsedTimer stats_timer;
+    unsigned long long frames;
+};
+
+
+//! Drives nonblocking writes to every tty output from a single epoll thread.
+class TtyWriter : public QThread
+{
+    Q_OBJECT
+
+public:
+    TtyWriter();
+    ~TtyWriter();
+
+    TtyPort *add_port(Output *owner, const QString name, int sync_id);
+    void set_frame_sync(FrameSync *sync);
+    void wake(void);
+
+public slots:
+    void stop(void);
+
+protected:
+    void run(void);
+
+private:
+    bool open_port(TtyPort *port);
+    void close_port(TtyPort *port);
+    bool start_frame(TtyPort *port);
+    void flush_port(TtyPort *port);
+    void read_port(TtyPort *port);
+    bool commit_frame(void);
+    void print_stats(TtyPort *port);
+
+    int _epoll_fd;
+    int _wake_fd;
+    QAtomicInt _exit;
+
+    FrameSync *_sync;
+    QElapsedTimer _hold_timer;
+    // Arrived at the barrier and polling for its release, never waiting on it
+    bool _arrived;
+    bool _releasing;
+    unsigned long long _ticket;
+    qint64 _arrived_at;
+    qint64 _deadline;
+
+    QMutex _ports_lock;
+    QList<TtyPort *> _ports;
+
+    AllocationCheck _alloc_check;
+};
+
+
+//! Output that hands frames to a shared TtyWriter instead of blocking on the port.
+class TtySerial : public Output
+{
+    Q_OBJECT
+
+public:
+    TtySerial(const QString name, TtyWriter *writer, int sync_id);
+    ~TtySerial();
+
+public slots:
+    void write_data(void);
+
+public:
+    void reserve(int bytes);
+    void device_added(const QString path);
+    void device_removed(void);
+
+private:
+    TtyWriter *_writer;
+    TtyPort *_port;
+};
+
+#endif
@@ -22,45 +22,709 @@
 
 #include "unpacker.h"
 #include "color_correct.h"
+#include "protocol.h"
+#include "rle.h"
+#include "transpose.h"
+#include "remap.h"
 
+#include <algorithm>
+#include <cstring>
 
-Unpacker::Unpacker(int first, int last)
+
+// Channels as received, for gathering RGBW pixels before white is extracted
+static const uint8_t rgb_order[3] = {0, 1, 2};
+
+// Regions of _staging
+#define PLAYOUT_REGION 0
+#define BLENDED_REGION 1
+#define INGESTED_REGION 2
+
+// Work left for the assembly pool, run in this order
+#define JOB_ASSEMBLE 0x01
+#define JOB_QUEUE 0x02
+#define JOB_PLAYOUT 0x04
+#define JOB_INTERPOLATE 0x08
+
+
+Unpacker::Unpacker(int first, int last, StrandStore *store)
+    : _alloc_check("unpacker"), _ingest_check("ingest")
 {
     first_strand = first;
     last_strand = last;
+    _store = store;
+    _region = store->add_region(last - first + 1);
+    _staging.add_region(last - first + 1);
+    _staging.add_region(last - first + 1);
+    _staging.add_region(last - first + 1);
+    _dithered.add_region(last - first + 1);
+    _protocol = 1;
+    _frame_id = 0;
+    _partial = NULL;
+    _compress = false;
+    _format = PROTOCOL_FORMAT_888;
+    _dither = false;
+    _adaptive = NULL;
+    _interpolator = NULL;
+    _jitter_buffer = NULL;
+    _clock_sync = NULL;
+    _lanes = LANES_DEFAULT;
+    _frame_bytes = 0;
+    set_color_order(find_color_order(COLOR_ORDER_DEFAULT));
+    memset(strand_level, 0, sizeof(strand_level));
+    memset(_high_strand, 0, sizeof(_high_strand));
+    _ma_per_channel = POWER_DEFAULT_MA_PER_CHANNEL;
+    _power = NULL;
+    _global_power = NULL;
+    _power_output = 0;
+    _pool = NULL;
+    _jobs = 0;
+    _scheduled = false;
+    _reject_pending = false;
+    _ack_pending = false;
+    _acked_id = 0;
+    _acks = 0;
+    _assembly_bytes = 0;
+    _assembly_width = 1;
 }
 
 
 Unpacker::~Unpacker()
 {
+    delete _partial;
+    delete _adaptive;
+    delete _interpolator;
+    delete _jitter_buffer;
+    delete _power;
+}
+
+
+void Unpacker::set_protocol(int version)
+{
+    _protocol = version;
+}
+
+
+void Unpacker::set_lanes(int lanes)
+{
+    _lanes = lanes;
+}
+
+
+void Unpacker::set_strand_lengths(const QList<int> &pixels)
+{
+    _strand_bytes.clear();
+
+    int longest = 0;
+    int pixel_size = _color_order->pixel_size;
+    for (int i = 0; i < pixels.size(); i++) {
+        _strand_bytes.push_back(pixels[i] * pixel_size);
+        longest = qMax(longest, pixels[i] * pixel_size);
+    }
+
+    resize_strands(longest);
+}
+
+
+void Unpacker::set_color_order(const ColorOrder *order)
+{
+    _color_order = order;
+
+    for (int format = 0; format < BIT_DEPTH_FORMATS; format++) {
+        bit_depth_planes(format, order, _planes[format]);
+    }
+}
+
+
+void Unpacker::set_gamma(double gamma)
+{
+    if (gamma == 1.0) {
+        _gamma.clear();
+    } else {
+        _gamma = high_depth_gamma_table(gamma);
+    }
+}
+
+
+void Unpacker::set_remap(const std::vector<int32_t> &layout)
+{
+    _remap = compile_remap(layout);
+
+    // RGBW pixels are gathered as RGB first, then get their white channel
+    if (_color_order->pixel_size != 3) {
+        _remapped.resize(_remap.size() * 3);
+    }
+
+    int bytes = _remap.size() * _color_order->pixel_size;
+    if (_strand_bytes.empty() && bytes > _frame_bytes) {
+        resize_strands(bytes);
+    }
+}
+
+
+void Unpacker::resize_strands(int bytes)
+{
+    // Every strand of the output is the same size and zero past its own length,
+    // so the transpose never has to check bounds
+    _store->resize_region(_region, bytes);
+    _frame_bytes = bytes;
+
+    // High-depth strands are laid out by the old size, wait for new data
+    if (!_high_data.empty()) {
+        _high_data.clear();
+        memset(_high_strand, 0, sizeof(_high_strand));
+    }
+}
+
+
+void Unpacker::set_partial_updates(int keyframe_interval)
+{
+    delete _partial;
+    _partial = new PartialEncoder(COLUMN_SIZE, keyframe_interval);
+}
+
+
+void Unpacker::set_compression(bool enabled)
+{
+    _compress = enabled;
+}
+
+
+void Unpacker::set_bit_depth(uint8_t format, bool dither)
+{
+    _format = format;
+    _dither = dither;
+}
+
+
+void Unpacker::set_adaptive_bit_depth(bool dither)
+{
+    delete _adaptive;
+    _adaptive = new AdaptiveBitDepth(_color_order->pixel_size);
+    _dither = dither;
+}
+
+
+void Unpacker::set_interpolation(bool enabled)
+{
+    delete _interpolator;
+    _interpolator = enabled ? new Interpolator() : NULL;
+}
+
+
+void Unpacker::set_jitter_buffer(int target_ms)
+{
+    delete _jitter_buffer;
+    _jitter_buffer = (target_ms > 0) ? new JitterBuffer(target_ms) : NULL;
+}
+
+
+void Unpacker::set_clock_sync(ClockSync *clock_sync)
+{
+    _clock_sync = clock_sync;
+
+    // Frames wait in the jitter buffer until their presentation time
+    if (!_jitter_buffer) {
+        _jitter_buffer = new JitterBuffer(0);
+    }
+}
+
+
+void Unpacker::set_power_budget(double budget_ma, double ma_per_channel)
+{
+    delete _power;
+    _power = (budget_ma > 0) ? new PowerBudget(budget_ma) : NULL;
+    _ma_per_channel = ma_per_channel;
+}
+
+
+void Unpacker::set_global_power_budget(PowerBudget *budget, int output)
+{
+    _global_power = budget;
+    _power_output = output;
+}
+
+
+void Unpacker::set_assembly_pool(WorkPool *pool)
+{
+    _pool = pool;
+}
+
+
+void Unpacker::set_pipeline_depth(int frames, int output)
+{
+    _ingested.set_depth(frames, output);
+}
+
+
+int Unpacker::max_payload_size() const
+{
+    // Every channel byte at 8 bit planes, one bit per lane
+    int payload = _frame_bytes * _lanes;
+
+    // A partial frame can carry a range header for every pixel column on top
+    if (_partial) {
+        int columns = (_frame_bytes + _color_order->pixel_size - 1) / _color_order->pixel_size;
+        payload += PARTIAL_HEADER_SIZE + columns * PARTIAL_RANGE_HEADER_SIZE;
+    }
+    return payload;
+}
+
+
+void Unpacker::reserve_frames()
+{
+    int size = max_payload_size();
+    int count = last_strand - first_strand + 1;
+
+    _assembly_bytes = _frame_bytes;
+    _frame.reserve(size);
+    staging(INGESTED_REGION);
+    _ingested.reserve(count, _frame_bytes);
+    if (_partial) {
+        int columns = (_frame_bytes + _color_order->pixel_size - 1) / _color_order->pixel_size;
+        _partial->reserve(_frame_bytes * _lanes, columns);
+        _partial_frame.reserve(size);
+    }
+    if (_compress) {
+        _compressed_frame.reserve(size);
+    }
+    if (_dither) {
+        _temporal_dither.resize(qMin(count, _lanes) * _frame_bytes);
+    }
+
+    if (_jitter_buffer) {
+        staging(PLAYOUT_REGION);
+        _jitter_buffer->reserve(count * _frame_bytes);
+    }
+    if (_interpolator) {
+        staging(BLENDED_REGION);
+        _interpolator->reserve(count * _frame_bytes);
+    }
+}
+
+
+void Unpacker::frame_acked(quint32 frame_id)
+{
+    // Applied by the next assembly run
+    QMutexLocker locker(&_jobs_lock);
+
+    if (!_ack_pending || (int32_t)(frame_id - _acked_id) > 0) {
+        _acked_id = frame_id;
+    }
+    _ack_pending = true;
+    _acks++;
+}
+
+
+void Unpacker::frame_rejected()
+{
+    QMutexLocker locker(&_jobs_lock);
+
+    // Acks from before the rejection no longer count
+    _reject_pending = true;
+    _ack_pending = false;
+}
+
+
+void Unpacker::apply_replies(bool rejected, bool acked, quint32 acked_id, int acks)
+{
+    if (_partial) {
+        if (rejected) {
+            _partial->reject();
+        }
+        if (acked) {
+            _partial->ack(acked_id);
+        }
+    }
+    if (_adaptive) {
+        for (int i = 0; i < acks; i++) {
+            _adaptive->frame_acked();
+        }
+    }
+}
+
+
+StrandView Unpacker::strands() const
+{
+    return _store->view(_region);
+}
+
+
+StrandView Unpacker::staging(int region)
+{
+    // Laid out like the frames being assembled
+    if (_staging.view(region).length != _assembly_bytes) {
+        _staging.resize_region(region, _assembly_bytes);
+    }
+
+    StrandView view = _staging.view(region);
+    view.width = _assembly_width;
+    return view;
 }
 
 
 void Unpacker::assemble_data()
 {
-    QByteArray data;
-    data.resize(strand_data[first_strand].length() * 8);
-    data.fill(0);
+    dispatch(JOB_ASSEMBLE);
+}
+
+
+void Unpacker::frame_received()
+{
+    dispatch(JOB_QUEUE);
+}
+
+
+void Unpacker::playout_frame()
+{
+    dispatch(JOB_PLAYOUT);
+}
+
+
+void Unpacker::interpolate_frame()
+{
+    dispatch(JOB_INTERPOLATE);
+}
+
+
+void Unpacker::dispatch(int job)
+{
+    _jobs_lock.lock();
+    _jobs |= job;
+    bool start = !_scheduled;
+    _scheduled = true;
+    _jobs_lock.unlock();
+
+    // Already queued or running, that run picks this job up too
+    if (!start) {
+        return;
+    }
+
+    // Nothing is held here, so a full pool just means running it on this thread
+    if (_pool == NULL || !_pool->submit(this)) {
+        run_work();
+    }
+}
+
+
+void Unpacker::run_work()
+{
+    QMutexLocker locker(&_jobs_lock);
+
+    // Jobs dispatched while this runs are picked up before letting go
+    for (;;) {
+        int jobs = _jobs;
+        if (jobs == 0) {
+            _scheduled = false;
+            return;
+        }
+
+        bool rejected = _reject_pending;
+        bool acked = _ack_pending;
+        quint32 acked_id = _acked_id;
+        int acks = _acks;
+        _jobs = 0;
+        _reject_pending = false;
+        _ack_pending = false;
+        _acks = 0;
+        locker.unlock();
+
+        apply_replies(rejected, acked, acked_id, acks);
+        run_jobs(jobs);
+
+        locker.relock();
+    }
+}
+
+
+void Unpacker::run_jobs(int jobs)
+{
+    if (jobs & JOB_ASSEMBLE) {
+        assemble_frame();
+    }
+    if (jobs & JOB_QUEUE) {
+        queue_frame();
+    }
+    if (jobs & JOB_PLAYOUT) {
+        play_frame();
+    }
+    if (jobs & JOB_INTERPOLATE) {
+        blend_frame();
+    }
+}
+
+
+void Unpacker::assemble_frame()
+{
+    TrackAllocations tracking;
+    uint64_t level;
+    qint64 pts;
+    _assembly_bytes = _ingested.length();
+    _assembly_width = _ingested.width();
+    StrandView ingested = staging(INGESTED_REGION);
+
+    // Only the newest frame is worth the work when assembly fell behind,
+    // the older ones would be dropped on the way to the writer anyway
+    if (_ingested.pop_newest(ingested, &level, &pts)) {
+        assemble(ingested, level);
+    }
+}
+
+
+void Unpacker::unpack_high_depth_strand(int strand, const uint8_t *src, int src_pixels, int pixels)
+{
+    size_t size = (size_t)(last_strand - first_strand + 1) * _frame_bytes;
+    if (_high_data.size() != size) {
+        // Strands were resized, which moves them all: start over from this frame
+        _high_data.assign(size, 0);
+        memset(_high_strand, 0, sizeof(_high_strand));
+    }
+
+    uint16_t *out = _high_data.data() + (size_t)(strand - first_strand) * _frame_bytes;
+    int copy = pixels * _color_order->pixel_size;
+
+    unpack_high_depth(src, src_pixels, _remap.empty() ? NULL : _remap.data(), pixels, _color_order,
+                      _gamma.empty() ? NULL : _gamma.data(), out);
+    std::fill(out + copy, out + _frame_bytes, 0);
+
+    _high_strand[strand] = true;
+}
+
+
+StrandView Unpacker::widen_strands()
+{
+    StrandView view = strands();
+
+    // Strands sent at 8 bits this frame join the high-depth ones, 0xAB as 0xABAB
+    for (int i = first_strand; i <= last_strand; i++) {
+        if (_high_strand[i]) {
+            continue;
+        }
+
+        const uint8_t *src = view.strand(i - first_strand);
+        uint16_t *dst = _high_data.data() + (size_t)(i - first_strand) * _frame_bytes;
+        for (int j = 0; j < _frame_bytes; j++) {
+            dst[j] = src[j] * 0x101;
+        }
+    }
+
+    StrandView wide;
+    wide.data = (uint8_t *)_high_data.data();
+    wide.stride = _frame_bytes * 2;
+    wide.count = last_strand - first_strand + 1;
+    wide.length = _frame_bytes * 2;
+    wide.width = 2;
+    return wide;
+}
+
+
+StrandView Unpacker::dither_frame(const StrandView &frame, uint64_t *level)
+{
+    // A store of its own, resizing a staging region would move frame
+    int length = frame.length / 2;
+    if (_dithered.view(0).length != length) {
+        _dithered.resize_region(0, length);
+    }
+    StrandView out = _dithered.view(0);
+
+    // The remainders follow the frames handed to the output, interpolated
+    // ones included, so they average out at the output's own rate
+    size_t size = (size_t)frame.count * length;
+    if (_high_error.size() != size) {
+        _high_error.assign(size, 0);
+    }
+
+    uint64_t sum = 0;
+    for (int i = 0; i < frame.count; i++) {
+        sum += dither_high_depth((const uint16_t *)frame.strand(i), _high_error.data() + (size_t)i * length,
+                                 out.strand(i), length);
+    }
+    *level = sum;
+    return out;
+}
+
+
+uint64_t Unpacker::frame_level() const
+{
+    uint64_t level = 0;
+    for (int i = first_strand; i <= last_strand; i++) {
+        level += strand_level[i];
+    }
+    return level;
+}
+
+
+uint32_t Unpacker::power_limit(uint64_t level)
+{
+    uint32_t scale = POWER_SCALE_ONE;
+    double draw_ma = level * _ma_per_channel / 255;
+
+    if (_power) {
+        scale = _power->limit(0, draw_ma);
+    }
+    if (_global_power) {
+        // The shared budget sees what this output draws after its own limit
+        uint32_t global = _global_power->limit(_power_output, draw_ma * scale / POWER_SCALE_ONE);
+        scale = ((uint64_t)scale * global) >> POWER_SCALE_BITS;
+    }
+
+    return scale;
+}
+
+
+void Unpacker::queue_frame()
+{
+    if (!_jitter_buffer && !_interpolator) {
+        assemble_frame();
+        return;
+    }
+
+    TrackAllocations tracking;
+    uint64_t level;
+    qint64 pts;
+    _assembly_bytes = _ingested.length();
+    _assembly_width = _ingested.width();
+    StrandView ingested = staging(INGESTED_REGION);
+
+    while (_ingested.pop(ingested, &level, &pts)) {
+        if (_jitter_buffer) {
+            qint64 present_us = -1;
+            if (_clock_sync && pts >= 0 && _clock_sync->synced()) {
+                present_us = _clock_sync->to_local_us(pts);
+            }
+            _jitter_buffer->push(ingested, level, present_us);
+            _alloc_check.frame_done();
+        } else if (_interpolator) {
+            _interpolator->push(ingested, level);
+            _alloc_check.frame_done();
+        }
+    }
+}
+
+
+void Unpacker::play_frame()
+{
+    if (!_jitter_buffer) {
+        return;
+    }
+
+    TrackAllocations tracking;
+    uint64_t level;
+    StrandView playout = staging(PLAYOUT_REGION);
+    if (!_jitter_buffer->pop(playout, &level)) {
+        return;
+    }
+
+    if (_interpolator) {
+        _interpolator->push(playout, level);
+        _alloc_check.frame_done();
+    } else {
+        assemble(playout, level);
+    }
+}
 
-    // LOL not optimal at all... I'm tired
-    int pixelptr = 0;
-    for (int dataptr = 0; dataptr < data.length(); dataptr += 8) {
 
-        for (int i = first_strand; i <= last_strand; i++) {
+void Unpacker::blend_frame()
+{
+    if (!_interpolator) {
+        return;
+    }
 
-            uint8_t strand_shift = (i - first_strand);
-            uint8_t strand_pixel_data = strand_data[i][pixelptr];
+    TrackAllocations tracking;
+    uint64_t level;
+    StrandView blended = staging(BLENDED_REGION);
+    if (_interpolator->render(blended, &level)) {
+        assemble(blended, level);
+    }
+}
 
-            data[dataptr + 0] = data[dataptr + 0] | ((strand_pixel_data & (1 << 7)) ? (1 << strand_shift) : 0);
-            data[dataptr + 1] = data[dataptr + 1] | ((strand_pixel_data & (1 << 6)) ? (1 << strand_shift) : 0);
-            data[dataptr + 2] = data[dataptr + 2] | ((strand_pixel_data & (1 << 5)) ? (1 << strand_shift) : 0);
-            data[dataptr + 3] = data[dataptr + 3] | ((strand_pixel_data & (1 << 4)) ? (1 << strand_shift) : 0);
-            data[dataptr + 4] = data[dataptr + 4] | ((strand_pixel_data & (1 << 3)) ? (1 << strand_shift) : 0);
-            data[dataptr + 5] = data[dataptr + 5] | ((strand_pixel_data & (1 << 2)) ? (1 << strand_shift) : 0);
-            data[dataptr + 6] = data[dataptr + 6] | ((strand_pixel_data & (1 << 1)) ? (1 << strand_shift) : 0);
-            data[dataptr + 7] = data[dataptr + 7] | ((strand_pixel_data & (1 << 0)) ? (1 << strand_shift) : 0);
+
+template <int LANES>
+void Unpacker::pack(const StrandView &frame, const uint8_t *planes, uint32_t scale, uint8_t *out)
+{
+    int count = (frame.count < LANES) ? frame.count : LANES;
+    int strand_length = frame.length;
+    int channels = _color_order->pixel_size;
+
+    // All strands are padded to strand_length (see resize_strands)
+    const uint8_t *source[LANES];
+    for (int lane = 0; lane < count; lane++) {
+        source[lane] = frame.strand(lane);
+    }
+
+    if (_dither) {
+        _temporal_dither.resize(count * strand_length);
+    }
+
+    // Unused lanes stay dark
+    uint8_t values[LANES];
+    memset(values, 0, LANES);
+
+    for (int pixelptr = 0; pixelptr < strand_length; pixelptr++) {
+        int bits = planes[pixelptr % channels];
+
+        for (int lane = 0; lane < count; lane++) {
+            uint8_t value = source[lane][pixelptr];
+
+            // Over the power budget: dimmed here rather than in a pass of its own
+            if (scale < POWER_SCALE_ONE) {
+                value = power_scale(value, scale);
+            }
+            if (_dither && bits < 8) {
+                value = _temporal_dither.quantize(lane * strand_length + pixelptr, value, bits);
+            }
+            values[lane] = value;
         }
-        pixelptr++;
+
+        transpose_planes<LANES>(values, bits, out);
+        out += bits * (LANES / 8);
+    }
+}
+
+
+void Unpacker::assemble(const StrandView &staged, uint64_t level)
+{
+    // 16-bit frames come down to 8 bits here, and their level with them
+    StrandView assembled = (staged.width == 2) ? dither_frame(staged, &level) : staged;
+    int strand_length = assembled.length;
+    int channels = _color_order->pixel_size;
+
+    if (_adaptive) {
+        _format = _adaptive->format();
+    }
+
+    // One bit plane word per lane group, 8 per channel unless the format drops some
+    const uint8_t *planes = _planes[(_format < BIT_DEPTH_FORMATS) ? _format : PROTOCOL_FORMAT_888];
+    int payload_length = 0;
+    for (int i = 0; i < strand_length; i++) {
+        payload_length += planes[i % channels] * (_lanes / 8);
+    }
+
+    // The payload gets a buffer of its own, reserved by reserve_frames() so
+    // resizing it never reallocates.  Framing goes in _header and _trailer.
+    QByteArray &data = _frame;
+    if (data.capacity() < payload_length) {
+        data.reserve(payload_length);
+    }
+    data.resize(payload_length);
+
+    uint32_t scale = (_power || _global_power) ? power_limit(level) : POWER_SCALE_ONE;
+
+    // Every payload byte gets written by the transpose
+    uint8_t *payload_data = (uint8_t *)data.data();
+    switch (_lanes) {
+    case 16:
+        pack<16>(assembled, planes, scale, payload_data);
+        break;
+    case 32:
+        pack<32>(assembled, planes, scale, payload_data);
+        break;
+    default:
+        pack<8>(assembled, planes, scale, payload_data);
+        break;
+    }
+
+    if (_adaptive) {
+        _adaptive->frame_sent(strand_length / channels);
     }
 
     // Bytes 1 and 2 contained the length of the strand data.
@@ -69,12 +733,78 @@ void Unpacker::assemble_data()
     //data.prepend('\0');
     //data.prepend('\0');
 
-    // Start frame of video data
-    data.prepend('*');
+    OutputFrame out;
+
+    if (_protocol == 2) {
+        FrameHeader frame;
+        frame.type = PROTOCOL_TYPE_FULL;
+        frame.flags = 0;
+        frame.format = _format;
+        frame.length = payload_length;
+        frame.frame_id = _frame_id++;
+
+        const uint8_t *payload = (const uint8_t *)data.constData();
+        size_t partial_length = 0;
+        if (_partial) {
+            _partial->set_block_size(bit_depth_column_size(_format, channels) * (_lanes / 8));
+            partial_length = _partial->update(payload, payload_length, frame.frame_id);
+        }
+
+        if (partial_length > 0) {
+            // Only the columns that changed since the last frame the Teensy confirmed
+            frame.type = PROTOCOL_TYPE_PARTIAL;
+            frame.length = partial_length;
+
+            if (_partial_frame.capacity() < (int)partial_length) {
+                _partial_frame.reserve(partial_length);
+            }
+            _partial_frame.resize(partial_length);
+            _partial->write_partial(payload, (uint8_t *)_partial_frame.data());
+            payload = (const uint8_t *)_partial_frame.constData();
+        }
+
+        if (_compress) {
+            // Reserved once so shrinking to fit each frame never reallocates
+            if (_compressed_frame.capacity() < payload_length) {
+                _compressed_frame.reserve(payload_length);
+            }
+            _compressed_frame.resize(payload_length);
+
+            // Only worth it if it comes out smaller
+            size_t compressed_length = rle_encode(payload, frame.length,
+                                                  (uint8_t *)_compressed_frame.data(), frame.length - 1);
+            if (compressed_length > 0) {
+                frame.flags |= PROTOCOL_FLAG_RLE;
+                frame.length = compressed_length;
+                _compressed_frame.resize(compressed_length);
+                payload = (const uint8_t *)_compressed_frame.constData();
+            }
+        }
+
+        seal_frame(_header, payload, _trailer, frame);
+
+        out.data[FRAME_HEADER] = (const char *)_header;
+        out.length[FRAME_HEADER] = PROTOCOL_HEADER_SIZE;
+        out.data[FRAME_PAYLOAD] = (const char *)payload;
+        out.length[FRAME_PAYLOAD] = frame.length;
+        out.data[FRAME_TRAILER] = (const char *)_trailer;
+        out.length[FRAME_TRAILER] = PROTOCOL_TRAILER_SIZE;
+    } else {
+        // Start frame of video data
+        _header[0] = PROTOCOL_V1_START;
+
+        out.data[FRAME_HEADER] = (const char *)_header;
+        out.length[FRAME_HEADER] = 1;
+        out.data[FRAME_PAYLOAD] = data.constData();
+        out.length[FRAME_PAYLOAD] = payload_length;
+        out.data[FRAME_TRAILER] = NULL;
+        out.length[FRAME_TRAILER] = 0;
+    }
 
     //qDebug() << "data_ready";
 
-    emit data_ready(&data);
+    emit data_ready(&out);
+    _alloc_check.frame_done();
 }
 
 
@@ -84,39 +814,83 @@ void Unpacker::unpack_data(QByteArray data)
         return;
     }
 
+    TrackAllocations tracking;
     char cmd = data.at(0);
 
     if (cmd == 'B') {
         emit frame_begin();
         return;
     } else if (cmd == 'E') {
+        qint64 pts = (data.length() >= FRAME_END_PTS_SIZE) ? read_timestamp(data.constData() + 1) : -1;
+
+        // Hands the frame on, so the strands are free for the next one right away.
+        // Once an output has had high-depth strands its frames stay at 16 bits
+        // up to assembly, and their level is taken as they are dithered there.
+        if (_high_data.empty()) {
+            _ingested.push(strands(), frame_level(), pts);
+        } else {
+            _ingested.push(widen_strands(), 0, pts);
+        }
+
         emit frame_end();
+        _ingest_check.frame_done();
         return;
-    } else if (cmd == 'S') {
+    } else if (cmd == 'S' || cmd == HIGH_DEPTH_STRAND) {
 
         // Process strand data
         //Q_ASSERT(data->length() > 4);
 
         uint8_t strand = data.at(1);
-        uint8_t strand_idx = strand;
         uint16_t len = (data.at(2) & 0xFF) | ((data.at(3) << 8) & 0xFF00);
 
         Q_ASSERT(strand < (MAX_STRANDS - 1));
 
         if ((strand >= first_strand) && (strand <= last_strand)) {
-            strand_data[strand_idx] = data.right(len);
-
-            // Swap color order and do color correction
-            for (int i = 0; i < len; i+=3) {
-                char tmp = strand_data[strand_idx][i];
-                strand_data[strand_idx][i] = strand_data[strand_idx][i + 1];
-                strand_data[strand_idx][i + 1] = tmp;
-
-                // hacky color correction
-                //strand_data[strand_idx][i] = color_correct(strand_data[strand_idx][i]);
-                //strand_data[strand_idx][i + 1] = color_correct(strand_data[strand_idx][i + 1]);
-                //strand_data[strand_idx][i + 2] = color_correct(strand_data[strand_idx][i + 2]);
+            int length = qMin((int)len, data.length() - 4);
+            if (length < 0) {
+                return;
             }
+
+            // A remapped strand is as long as its layout.  RGBW pixels take 4 bytes for every 3 received.
+            bool high_depth = (cmd == HIGH_DEPTH_STRAND);
+            int received = high_depth ? length / 6 : length / 3;
+            int pixel_size = _color_order->pixel_size;
+            int produced = (_remap.empty() ? received : (int)_remap.size()) * pixel_size;
+
+            // Declared strands keep their length; otherwise every strand is padded to the longest seen
+            int capacity = _strand_bytes.empty() ? produced : _strand_bytes[strand - first_strand];
+            if (_strand_bytes.empty() && produced > _frame_bytes) {
+                resize_strands(produced);
+            }
+
+            int copy = qMin(produced, capacity);
+            int pixels = copy / pixel_size;
+            copy = pixels * pixel_size;
+
+            const char *src = data.constData() + data.length() - length;
+            char *dst = (char *)strands().strand(strand - first_strand);
+
+            if (high_depth) {
+                // Kept at 16 bits until the frame is dithered
+                unpack_high_depth_strand(strand, (const uint8_t *)src, received, pixels);
+                return;
+            }
+            _high_strand[strand] = false;
+
+            // Each kernel also sums what it writes, for the power estimate
+            if (!_remap.empty() && pixel_size == 3) {
+                // Gathers through the layout and reorders colors in one pass
+                strand_level[strand] = remap_pixels((const uint8_t *)src, length, _remap.data(), pixels, _color_order->channel, (uint8_t *)dst);
+            } else if (!_remap.empty()) {
+                uint8_t *remapped = (uint8_t *)_remapped.data();
+                remap_pixels((const uint8_t *)src, length, _remap.data(), pixels, rgb_order, remapped);
+                strand_level[strand] = _color_order->kernel(remapped, (uint8_t *)dst, pixels);
+            } else {
+                strand_level[strand] = _color_order->kernel((const uint8_t *)src, (uint8_t *)dst, pixels);
+            }
+
+            // A short packet leaves the rest of the strand dark
+            memset(dst + copy, 0, _frame_bytes - copy);
         }
     }
 }
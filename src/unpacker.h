@@ -24,36 +24,209 @@
 #define _UNPACKER_H
 
 #include "portability.h"
+#include "protocol.h"
+#include "partial.h"
+#include "bit_depth.h"
+#include "interpolate.h"
+#include "jitter_buffer.h"
+#include "clock_sync.h"
+#include "color_order.h"
+#include "power.h"
+#include "high_depth.h"
+#include "strand_store.h"
+#include "alloc_tracker.h"
+#include "frame.h"
+#include "work_pool.h"
+#include "pipeline.h"
 
 #include <QtCore/QObject>
+#include <QtCore/QList>
 #include <QtCore/QDebug>
+#include <QtCore/QMutex>
+
+#include <vector>
 
 #define MAX_STRANDS 128
 
+// Longest strand-lengths entry: a strand's bytes must fit the 16-bit length field
+#define MAX_STRAND_PIXELS (65535 / 3)
+
+// Bytes per pixel column of the bit-plane buffer with 8 lanes: 3 channels of 8 bit planes
+// (4 for RGBW)
+#define COLUMN_SIZE 24
+
 
 //! Unpacks data received over the network
-class Unpacker : public QObject
+class Unpacker : public QObject, public WorkItem
 {
     Q_OBJECT
 
 public:
-    Unpacker(int first, int last);
+    //! Keeps strands first to last in a region of store.
+    Unpacker(int first, int last, StrandStore *store);
     ~Unpacker();
 
+    // Every output's state on cache lines of its own, since pool threads
+    // assemble outputs side by side
+    static void *operator new(size_t size) { return qMallocAligned(size, CACHE_LINE_SIZE); }
+    static void operator delete(void *ptr) { qFreeAligned(ptr); }
+
+    void set_protocol(int version);
+    void set_lanes(int lanes);
+    //! Sets the byte order on the wire, and whether pixels are RGBW.
+    //! Call before set_strand_lengths() and set_remap().
+    void set_color_order(const ColorOrder *order);
+    //! Gamma curve for high-depth strands (src/high_depth.h), 1 for none.
+    void set_gamma(double gamma);
+    //! Declares each strand's length in pixels, from first to last.
+    void set_strand_lengths(const QList<int> &pixels);
+    //! Applies a pixel layout (see src/remap.h) to every strand.
+    void set_remap(const std::vector<int32_t> &layout);
+    void set_partial_updates(int keyframe_interval);
+    void set_compression(bool enabled);
+    void set_bit_depth(uint8_t format, bool dither);
+    void set_adaptive_bit_depth(bool dither);
+    void set_interpolation(bool enabled);
+    void set_jitter_buffer(int target_ms);
+    void set_clock_sync(ClockSync *clock_sync);
+    //! Limits this output to budget_ma (0 for no limit of its own), with each
+    //! channel drawing ma_per_channel at full brightness.
+    void set_power_budget(double budget_ma, double ma_per_channel);
+    //! Also keeps this output, as number output, within a budget shared with others.
+    void set_global_power_budget(PowerBudget *budget, int output);
+    //! Assembles frames on pool instead of the thread that delivers the slots below.
+    //! data_ready() is then emitted from a pool thread.
+    void set_assembly_pool(WorkPool *pool);
+    //! Frames received but not yet assembled that are kept, past which the
+    //! oldest is dropped.  output numbers the occupancy report.
+    void set_pipeline_depth(int frames, int output);
+
+    //! Preallocates every per-frame buffer for the strand lengths set so far.
+    //! Call once the output is configured; only strands without declared
+    //! lengths grow buffers after this.
+    void reserve_frames(void);
+    //! Largest payload data_ready() can carry, in bytes.
+    int max_payload_size(void) const;
+
+    //! Runs the jobs the slots below left for the pool.
+    void run_work(void);
+
 public slots:
     void unpack_data(QByteArray data);
     void assemble_data(void);
+    void frame_received(void);
+    void playout_frame(void);
+    void interpolate_frame(void);
+    void frame_acked(quint32 frame_id);
+    void frame_rejected(void);
 
 signals:
-    void data_ready(QByteArray *data); 
+    //! frame points into buffers that are reused for the next one.
+    void data_ready(const OutputFrame *frame);
     void frame_begin(void);
     void frame_end(void);
 
 private:
-    QByteArray strand_data[MAX_STRANDS];
+    void dispatch(int job);
+    void run_jobs(int jobs);
+    void assemble_frame(void);
+    void queue_frame(void);
+    void play_frame(void);
+    void blend_frame(void);
+
+    StrandView strands(void) const;
+    StrandView staging(int region);
+    void apply_replies(bool rejected, bool acked, quint32 acked_id, int acks);
+    void assemble(const StrandView &staged, uint64_t level);
+    uint64_t frame_level(void) const;
+    void unpack_high_depth_strand(int strand, const uint8_t *src, int src_pixels, int pixels);
+    StrandView widen_strands(void);
+    StrandView dither_frame(const StrandView &frame, uint64_t *level);
+    uint32_t power_limit(uint64_t level);
+    void resize_strands(int bytes);
+    template <int LANES>
+    void pack(const StrandView &frame, const uint8_t *planes, uint32_t scale, uint8_t *out);
+
+    StrandStore *_store;
+    int _region;
+    //! Sum of each strand's channel bytes, from the last time it was unpacked
+    uint32_t strand_level[MAX_STRANDS];
     int first_strand;
     int last_strand;
 
+    std::vector<int> _strand_bytes;
+    int _frame_bytes;
+    //! Strand length of the frames being assembled, which trails _frame_bytes
+    //! until a frame of the new size comes out of _ingested
+    int _assembly_bytes;
+    //! Channel width of those frames, 2 once high-depth strands arrive
+    int _assembly_width;
+    std::vector<int32_t> _remap;
+    QByteArray _remapped;
+    const ColorOrder *_color_order;
+    //! Planes per wire channel of each format, for _color_order
+    uint8_t _planes[BIT_DEPTH_FORMATS][BIT_DEPTH_MAX_CHANNELS];
+
+    //! 16-bit channels of the frame being received, _frame_bytes per strand
+    //! from first_strand.  Empty until a high-depth strand arrives.
+    std::vector<uint16_t> _high_data;
+    //! Dither remainders of every channel, kept by assembly
+    std::vector<uint8_t> _high_error;
+    bool _high_strand[MAX_STRANDS];
+    std::vector<uint16_t> _gamma;
+
+    int _protocol;
+    int _lanes;
+    uint32_t _frame_id;
+    QByteArray _frame;
+    uint8_t _header[PROTOCOL_HEADER_SIZE];
+    uint8_t _trailer[PROTOCOL_TRAILER_SIZE];
+
+    PartialEncoder *_partial;
+    QByteArray _partial_frame;
+
+    bool _compress;
+    QByteArray _compressed_frame;
+
+    uint8_t _format;
+    bool _dither;
+    TemporalDither _temporal_dither;
+    AdaptiveBitDepth *_adaptive;
+
+    Interpolator *_interpolator;
+    JitterBuffer *_jitter_buffer;
+    //! Frames coming out of the ingest queue, the jitter buffer and the interpolator
+    StrandStore _staging;
+    //! 16-bit frames dithered down for assembly
+    StrandStore _dithered;
+    //! Strands of received frames, from the ingest thread to assembly
+    StrandQueue _ingested;
+
+    ClockSync *_clock_sync;
+
+    double _ma_per_channel;
+    PowerBudget *_power;
+    PowerBudget *_global_power;
+    int _power_output;
+
+    AllocationCheck _alloc_check;
+    //! Unpacking on the receiving thread, checked at every frame end
+    AllocationCheck _ingest_check;
+
+    WorkPool *_pool;
+
+    // Handed from the receiving and writing threads to assembly.  The lock is
+    // only held to read or update these, never while assembling.
+    Q_DECL_ALIGN(CACHE_LINE_SIZE) QMutex _jobs_lock;
+    //! JOB_* waiting to run
+    int _jobs;
+    //! Submitted to the pool or running: at most one run at a time
+    bool _scheduled;
+    //! Replies from the receiver since the last run
+    bool _reject_pending;
+    bool _ack_pending;
+    quint32 _acked_id;
+    int _acks;
 };
 
 #endif
@@ -1,34 +1,72 @@
+// FireNode
+// Copyright (c) 2013 Jon Evans
+// http://craftyjon.com/projects/openlights/firenode
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
 #include "usb.h"
 
+#include <cstring>
+#include <QtCore/QElapsedTimer>
+
 
-USBStrandController::USBStrandController()
+#ifdef USE_LIBUSB
+LibusbTransport::LibusbTransport()
 {
+    _ctx = NULL;
     _handle = NULL;
+
+    if (libusb_init(&_ctx) < 0) {
+        qDebug() << "Error initializing libusb.";
+        _ctx = NULL;
+        return;
+    }
+
+#if defined(LIBUSB_API_VERSION) && (LIBUSB_API_VERSION >= 0x01000106)
+    libusb_set_option(_ctx, LIBUSB_OPTION_LOG_LEVEL, LIBUSB_LOG_LEVEL_INFO);
+#else
+    libusb_set_debug(_ctx, LIBUSB_LOG_LEVEL_INFO);
+#endif
 }
 
 
-USBStrandController::~USBStrandController()
+LibusbTransport::~LibusbTransport()
 {
-    if (_handle != NULL) {
-        libusb_close(_handle);
+    close();
+
+    if (_ctx != NULL) {
+        libusb_exit(_ctx);
     }
 }
 
 
-bool USBStrandController::connect()
+bool LibusbTransport::open()
 {
     int ret, cfg = -999;
-    libusb_context *ctx;
-    _handle = NULL;
 
-    if (libusb_init(&ctx) < 0) {
-        qDebug() << "Error initializing libusb.";
+    if (_ctx == NULL) {
         return false;
     }
 
-    libusb_set_debug(ctx, 3);
+    close();
 
-    _handle = libusb_open_device_with_vid_pid(ctx, STRAND_CONTROLLER_VID, STRAND_CONTROLLER_PID);
+    _handle = libusb_open_device_with_vid_pid(_ctx, STRAND_CONTROLLER_VID, STRAND_CONTROLLER_PID);
 
     if (_handle == NULL) {
         qDebug() << "Could not find strand controller.";
@@ -40,6 +78,7 @@ bool USBStrandController::connect()
 
         if (libusb_detach_kernel_driver(_handle, 0) != 0) {
             qDebug() << "Could not detach driver.";
+            close();
             return false;
         }
     }
@@ -49,24 +88,28 @@ bool USBStrandController::connect()
     ret = libusb_set_configuration(_handle, 1);
     if (ret < 0) {
         qDebug() << "Error setting config:" << libusb_error_name(ret);
+        close();
         return false;
     }
 
     ret = libusb_get_configuration(_handle, &cfg);
     if (ret < 0) {
         qDebug() << "Error getting config:" << libusb_error_name(ret);
+        close();
         return false;
     }
 
     ret = libusb_claim_interface(_handle, 0);
     if (ret < 0) {
         qDebug() << "Error claiming interface:" << libusb_error_name(ret);
+        close();
         return false;
     }
 
     ret = libusb_set_interface_alt_setting(_handle, 0, 1);
     if (ret < 0) {
         qDebug() << "Error setting up interface:" << libusb_error_name(ret);
+        close();
         return false;
     }
 
@@ -76,18 +119,354 @@ bool USBStrandController::connect()
 }
 
 
-void USBStrandController::write_data(QByteArray *data)
+void LibusbTransport::close()
+{
+    if (_handle != NULL) {
+        libusb_close(_handle);
+        _handle = NULL;
+    }
+}
+
+
+bool LibusbTransport::submit(UsbTransfer *transfer)
 {
-    int transferred = 0, ret;
-    unsigned char d[] = {0x04, 0x05};
+    if (_handle == NULL) {
+        return false;
+    }
+
+    // Allocated once per slot and reused for every chunk
+    struct libusb_transfer *t = (struct libusb_transfer *)transfer->handle;
+    if (t == NULL) {
+        t = libusb_alloc_transfer(0);
+        transfer->handle = t;
+    }
 
-    ret = libusb_bulk_transfer(_handle, EP_OUT, d, 2, &transferred, 1000);
+    libusb_fill_bulk_transfer(t, _handle, EP_OUT, (unsigned char *)transfer->buffer.data(),
+                              transfer->length, transfer_done, transfer, USB_TIMEOUT_MS);
 
+    int ret = libusb_submit_transfer(t);
     if (ret < 0) {
-        qDebug() << "bulk_transfer returned" << libusb_error_name(ret);
+        IgnoreAllocations ignore;
+        qDebug() << "submit_transfer returned" << libusb_error_name(ret);
+        return false;
+    }
+
+    return true;
+}
+
+
+void LibusbTransport::handle_events(int timeout_ms)
+{
+    // A NULL context would mean the default one, which nobody initialized
+    if (_ctx == NULL) {
+        QThread::msleep(timeout_ms);
+        return;
+    }
+
+    struct timeval tv;
+    tv.tv_sec = timeout_ms / 1000;
+    tv.tv_usec = (timeout_ms % 1000) * 1000;
+
+    libusb_handle_events_timeout_completed(_ctx, &tv, NULL);
+}
+
+
+void LibusbTransport::cancel(UsbTransfer *transfer)
+{
+    // Already finished is fine, its callback has run or is about to
+    if (transfer->handle != NULL) {
+        libusb_cancel_transfer((struct libusb_transfer *)transfer->handle);
+    }
+}
+
+
+void LibusbTransport::release(UsbTransfer *transfer)
+{
+    if (transfer->handle != NULL) {
+        libusb_free_transfer((struct libusb_transfer *)transfer->handle);
+        transfer->handle = NULL;
+    }
+}
+
+
+void LIBUSB_CALL LibusbTransport::transfer_done(struct libusb_transfer *t)
+{
+    UsbTransfer *transfer = (UsbTransfer *)t->user_data;
+
+    transfer->ok = (t->status == LIBUSB_TRANSFER_COMPLETED) && (t->actual_length == t->length);
+    if (!transfer->ok) {
+        qDebug() << "bulk transfer failed, status" << t->status << "wrote" << t->actual_length << "of" << t->length;
+    }
+
+    transfer->owner->transfer_complete(transfer);
+}
+#endif
+
+
+LoopbackTransport::LoopbackTransport()
+{
+    _bytes = 0;
+}
+
+
+bool LoopbackTransport::open()
+{
+    qDebug() << "Connected to loopback strand controller.";
+    return true;
+}
+
+
+void LoopbackTransport::close()
+{
+}
+
+
+bool LoopbackTransport::submit(UsbTransfer *transfer)
+{
+    QMutexLocker locker(&_lock);
+    _queue.enqueue(transfer);
+    _queued.wakeOne();
+    return true;
+}
+
+
+void LoopbackTransport::handle_events(int timeout_ms)
+{
+    _lock.lock();
+    if (_queue.isEmpty()) {
+        _queued.wait(&_lock, timeout_ms);
+    }
+
+    while (!_queue.isEmpty()) {
+        UsbTransfer *transfer = _queue.dequeue();
+        _bytes += transfer->length;
+        transfer->ok = true;
+
+        // Complete outside the lock, the owner will usually submit again
+        _lock.unlock();
+        transfer->owner->transfer_complete(transfer);
+        _lock.lock();
+    }
+    _lock.unlock();
+}
+
+
+unsigned long long LoopbackTransport::bytes_received()
+{
+    QMutexLocker locker(&_lock);
+    return _bytes;
+}
+
+
+UsbEventThread::UsbEventThread(UsbTransport *transport)
+{
+    _transport = transport;
+    _exit = 0;
+}
+
+
+void UsbEventThread::stop()
+{
+    _exit = 1;
+}
+
+
+void UsbEventThread::run()
+{
+    while (!_exit.load()) {
+        _transport->handle_events(USB_EVENT_TIMEOUT_MS);
+    }
+}
+
+
+USBStrandController::USBStrandController(UsbTransport *transport, RealtimePolicy *writer)
+    : _alloc_check("usb")
+{
+    _transport = transport;
+    _want_write = false;
+    _connected = false;
+    _exit = false;
+    _offset = 0;
+    _in_flight = 0;
+    _frames = 0;
+
+    for (int i = 0; i < USB_TRANSFERS; i++) {
+        _transfers[i].owner = this;
+        _transfers[i].handle = NULL;
+        _transfers[i].buffer.resize(USB_CHUNK_SIZE);
+        _transfers[i].length = 0;
+        _transfers[i].last = false;
+        _transfers[i].busy = false;
+        _transfers[i].ok = false;
+    }
+
+    connect();
+
+    _event_thread = new UsbEventThread(_transport);
+    realtime_prepare_thread(_event_thread, writer);
+    if (!realtime_start_thread(_event_thread, "usb event")) {
+        // Nothing would ever complete, so never submit
+        _exit = true;
+    }
+}
+
+
+USBStrandController::~USBStrandController()
+{
+    _lock.lock();
+    _exit = true;
+    _lock.unlock();
+
+    // Let the transfers already on the bus finish before tearing down
+    QElapsedTimer drain;
+    drain.start();
+    while (drain.elapsed() < USB_TIMEOUT_MS) {
+        _lock.lock();
+        int in_flight = _in_flight;
+        _lock.unlock();
+
+        if (in_flight == 0) {
+            break;
+        }
+        QThread::msleep(1);
+    }
+
+    // Anything still submitted belongs to libusb until its callback fires,
+    // so cancel it and keep handling events rather than freeing it under them
+    _lock.lock();
+    for (int i = 0; i < USB_TRANSFERS; i++) {
+        if (_transfers[i].busy) {
+            _transport->cancel(&_transfers[i]);
+        }
+    }
+    _lock.unlock();
+
+    for (;;) {
+        _lock.lock();
+        int in_flight = _in_flight;
+        _lock.unlock();
+
+        if (in_flight == 0) {
+            break;
+        }
+        QThread::msleep(1);
+    }
+
+    _event_thread->stop();
+    _event_thread->wait();
+    delete _event_thread;
+
+    for (int i = 0; i < USB_TRANSFERS; i++) {
+        _transport->release(&_transfers[i]);
+    }
+
+    _transport->close();
+    delete _transport;
+}
+
+
+bool USBStrandController::connect()
+{
+    _connected = _transport->open();
+    return _connected;
+}
+
+
+void USBStrandController::reserve(int bytes)
+{
+    // fill_transfers() swaps its frame with the queued ones, so it needs the same room
+    Output::reserve(bytes);
+    QMutexLocker locker(&_lock);
+    _active.reserve(bytes);
+}
+
+
+void USBStrandController::write_data()
+{
+    QMutexLocker locker(&_lock);
+
+    if (!_connected) {
+        if (_in_flight > 0 || !connect()) {
+            return;
+        }
+    }
+
+    _want_write = true;
+    fill_transfers();
+}
+
+
+void USBStrandController::transfer_complete(UsbTransfer *transfer)
+{
+    bool frame_done = false;
+
+    _lock.lock();
+    transfer->busy = false;
+    _in_flight--;
+
+    if (!transfer->ok) {
+        // Drop the rest of this frame and reconnect from the next write
+        _connected = false;
+        _offset = _active.size();
+    } else if (transfer->last) {
+        _frames++;
+        frame_done = true;
+    }
+
+    fill_transfers();
+    _lock.unlock();
+
+    if (frame_done) {
+        emit data_written();
     }
+}
+
 
-    /*if (transferred != data->size()) {
-        qDebug() << "Tried to write" << data->size() << "but actually wrote" << transferred;
-    }*/
-}
\ No newline at end of file
+void USBStrandController::fill_transfers()
+{
+    // Called with _lock held, from either the main thread or the event thread
+    TrackAllocations tracking;
+
+    for (int i = 0; i < USB_TRANSFERS; i++) {
+        if (_exit || !_connected) {
+            return;
+        }
+
+        UsbTransfer *transfer = &_transfers[i];
+        if (transfer->busy) {
+            continue;
+        }
+
+        if (_offset >= _active.size()) {
+            if (!_want_write) {
+                return;
+            }
+            _want_write = false;
+
+            // Keep resending the last frame until a newer one shows up.  The
+            // check takes whatever this thread counted since its last frame.
+            _alloc_check.frame_done();
+            next_frame(&_active);
+            _offset = 0;
+
+            if (_active.is_empty()) {
+                return;
+            }
+        }
+
+        int chunk = qMin(USB_CHUNK_SIZE, _active.size() - _offset);
+        _active.read(_offset, transfer->buffer.data(), chunk);
+        transfer->length = chunk;
+        transfer->last = (_offset + chunk == _active.size());
+        transfer->busy = true;
+
+        if (!_transport->submit(transfer)) {
+            transfer->busy = false;
+            _connected = false;
+            return;
+        }
+
+        _offset += chunk;
+        _in_flight++;
+    }
+}
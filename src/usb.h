@@ -1,9 +1,43 @@
+// FireNode
+// Copyright (c) 2013 Jon Evans
+// http://craftyjon.com/projects/openlights/firenode
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
 #ifndef _USB_H
 #define _USB_H
 
+#include "portability.h"
+#include "output.h"
+#include "realtime.h"
+
 #include <QtCore/QObject>
 #include <QtCore/QDebug>
+#include <QtCore/QThread>
+#include <QtCore/QMutex>
+#include <QtCore/QWaitCondition>
+#include <QtCore/QQueue>
+#include <QtCore/QAtomicInt>
+
+#ifdef USE_LIBUSB
 #include <libusb.h>
+#endif
 
 #define STRAND_CONTROLLER_VID 0x03EB
 #define STRAND_CONTROLLER_PID 0x1337
@@ -11,26 +45,147 @@
 #define EP_OUT 0x02
 #define EP_IN 0x81
 
+#define USB_TRANSFERS 4
+#define USB_CHUNK_SIZE 16384
+#define USB_TIMEOUT_MS 1000
+#define USB_EVENT_TIMEOUT_MS 100
+
+
+class USBStrandController;
+
+
+//! One bulk OUT transfer owned by a USBStrandController.
+struct UsbTransfer
+{
+    USBStrandController *owner;
+    void *handle;           // Transport specific, e.g. the libusb_transfer
+    QByteArray buffer;
+    int length;
+    bool last;              // Final chunk of a frame
+    bool busy;
+    bool ok;
+};
+
+
+//! Moves bulk transfers to a device.  Completions are delivered from handle_events().
+class UsbTransport
+{
+public:
+    virtual ~UsbTransport() {}
+
+    virtual bool open(void) = 0;
+    virtual void close(void) = 0;
+    virtual bool submit(UsbTransfer *transfer) = 0;
+    virtual void handle_events(int timeout_ms) = 0;
+    //! Asks a submitted transfer to finish early.  It still completes, failed,
+    //! through handle_events().
+    virtual void cancel(UsbTransfer *transfer) { Q_UNUSED(transfer); }
+    //! Frees what submit() set up for transfer, which must not be in flight.
+    virtual void release(UsbTransfer *transfer) { Q_UNUSED(transfer); }
+};
+
+
+#ifdef USE_LIBUSB
+//! Talks to a real strand controller through libusb's asynchronous API.
+class LibusbTransport : public UsbTransport
+{
+public:
+    LibusbTransport();
+    ~LibusbTransport();
+
+    bool open(void);
+    void close(void);
+    bool submit(UsbTransfer *transfer);
+    void handle_events(int timeout_ms);
+    void cancel(UsbTransfer *transfer);
+    void release(UsbTransfer *transfer);
+
+private:
+    static void LIBUSB_CALL transfer_done(struct libusb_transfer *t);
+
+    libusb_context *_ctx;
+    libusb_device_handle *_handle;
+};
+#endif
+
+
+//! Completes every transfer in-process so the USB output can run without hardware.
+class LoopbackTransport : public UsbTransport
+{
+public:
+    LoopbackTransport();
+
+    bool open(void);
+    void close(void);
+    bool submit(UsbTransfer *transfer);
+    void handle_events(int timeout_ms);
+
+    unsigned long long bytes_received(void);
+
+private:
+    QMutex _lock;
+    QWaitCondition _queued;
+    QQueue<UsbTransfer *> _queue;
+    unsigned long long _bytes;
+};
+
+
+//! Runs the transport's event loop so completions never wait on the main thread.
+class UsbEventThread : public QThread
+{
+    Q_OBJECT
+
+public:
+    UsbEventThread(UsbTransport *transport);
+
+public slots:
+    void stop(void);
+
+protected:
+    void run(void);
+
+private:
+    UsbTransport *_transport;
+    QAtomicInt _exit;
+};
+
 
 //! Device driver for the USB Strand Controller
-class USBStrandController : public QObject
+class USBStrandController : public Output
 {
     Q_OBJECT
 
 public:
-    USBStrandController();
+    //! The event thread applies writer, if given, as it starts.
+    USBStrandController(UsbTransport *transport, RealtimePolicy *writer = NULL);
     ~USBStrandController();
 
     bool connect(void);
+    void transfer_complete(UsbTransfer *transfer);
+    void reserve(int bytes);
 
 public slots:
-    void write_data(QByteArray *data);
+    void write_data(void);
 
 signals:
     void data_written(); 
 
 private:
-    libusb_device_handle *_handle;
+    void fill_transfers(void);
+
+    UsbTransport *_transport;
+    UsbEventThread *_event_thread;
+    UsbTransfer _transfers[USB_TRANSFERS];
+
+    QMutex _lock;
+    FrameBuffer _active;
+    bool _want_write;
+    bool _connected;
+    bool _exit;
+    int _offset;
+    int _in_flight;
+    unsigned long long _frames;
+    AllocationCheck _alloc_check;
 };
 
 #endif
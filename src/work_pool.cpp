@@ -0,0 +1,219 @@
+// FireNode
+// Copyright (c) 2013 Jon Evans
+// http://craftyjon.com/projects/openlights/firenode
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+
+#include "work_pool.h"
+
+#include <new>
+
+
+WorkPool::WorkPool(int threads, RealtimePolicy *policy)
+{
+    if (threads <= 0) {
+        threads = QThread::idealThreadCount();
+    }
+    _count = qBound(1, threads, WORK_POOL_MAX_THREADS);
+
+    _queued = 0;
+    _sleeping = 0;
+    _outstanding = 0;
+    _exit = 0;
+
+    // new ignores the alignment of Queue before C++17
+    _queues = (Queue *)qMallocAligned(_count * sizeof(Queue), CACHE_LINE_SIZE);
+    for (int i = 0; i < _count; i++) {
+        new (&_queues[i]) Queue;
+        _queues[i].sleeping = false;
+        _queues[i].head = 0;
+        _queues[i].count = 0;
+    }
+
+    for (int i = 0; i < _count; i++) {
+        _threads[i] = new WorkThread(this, i);
+        realtime_prepare_thread(_threads[i], policy);
+    }
+
+    _started = true;
+    for (int i = 0; i < _count; i++) {
+        if (!realtime_start_thread(_threads[i], "work pool")) {
+            _started = false;
+        }
+    }
+}
+
+
+WorkPool::~WorkPool()
+{
+    _exit.fetchAndStoreOrdered(1);
+    for (int i = 0; i < _count; i++) {
+        QMutexLocker locker(&_queues[i].lock);
+        _queues[i].wake.wakeAll();
+    }
+
+    for (int i = 0; i < _count; i++) {
+        _threads[i]->wait();
+        delete _threads[i];
+    }
+
+    for (int i = 0; i < _count; i++) {
+        _queues[i].~Queue();
+    }
+    qFreeAligned(_queues);
+}
+
+
+bool WorkPool::submit(WorkItem *item)
+{
+    int start = (unsigned)_next.fetchAndAddRelaxed(1) % _count;
+
+    _outstanding.fetchAndAddOrdered(1);
+
+    for (int i = 0; i < _count; i++) {
+        int index = (start + i) % _count;
+        Queue &queue = _queues[index];
+        QMutexLocker locker(&queue.lock);
+
+        if (queue.count < WORK_POOL_QUEUE_SIZE) {
+            queue.items[(queue.head + queue.count) % WORK_POOL_QUEUE_SIZE] = item;
+            queue.count++;
+            locker.unlock();
+
+            // Pairs with the check in take(): a worker either sees this item or is woken for it
+            _queued.fetchAndAddOrdered(1);
+            if (_sleeping.fetchAndAddOrdered(0) > 0) {
+                wake_worker(index);
+            }
+            return true;
+        }
+    }
+
+    // Every queue is full, the caller runs it instead
+    finished();
+    return false;
+}
+
+
+void WorkPool::wake_worker(int queue)
+{
+    for (int i = 0; i < _count; i++) {
+        Queue &worker = _queues[(queue + i) % _count];
+        QMutexLocker locker(&worker.lock);
+
+        if (worker.sleeping) {
+            worker.sleeping = false;
+            _sleeping.fetchAndAddOrdered(-1);
+            worker.wake.wakeOne();
+            return;
+        }
+    }
+}
+
+
+void WorkPool::wait_idle()
+{
+    QMutexLocker locker(&_idle_lock);
+    while (_outstanding.fetchAndAddOrdered(0) > 0) {
+        _drained.wait(&_idle_lock);
+    }
+}
+
+
+WorkItem *WorkPool::take(int worker)
+{
+    for (;;) {
+        // Own queue first, oldest item
+        Queue &own = _queues[worker];
+        own.lock.lock();
+        if (own.count > 0) {
+            WorkItem *item = own.items[own.head];
+            own.head = (own.head + 1) % WORK_POOL_QUEUE_SIZE;
+            own.count--;
+            own.lock.unlock();
+
+            _queued.fetchAndAddOrdered(-1);
+            return item;
+        }
+        own.lock.unlock();
+
+        // Then the newest item of whoever has one
+        for (int i = 1; i < _count; i++) {
+            Queue &victim = _queues[(worker + i) % _count];
+            victim.lock.lock();
+            if (victim.count > 0) {
+                victim.count--;
+                WorkItem *item = victim.items[(victim.head + victim.count) % WORK_POOL_QUEUE_SIZE];
+                victim.lock.unlock();
+
+                _queued.fetchAndAddOrdered(-1);
+                return item;
+            }
+            victim.lock.unlock();
+        }
+
+        // Sleep on our own queue.  Anything submitted after the scan above is
+        // either counted in _queued by now or its submitter sees us sleeping.
+        QMutexLocker locker(&own.lock);
+        if (_exit.fetchAndAddOrdered(0)) {
+            return NULL;
+        }
+
+        own.sleeping = true;
+        _sleeping.fetchAndAddOrdered(1);
+        if (_queued.fetchAndAddOrdered(0) == 0 && !_exit.fetchAndAddOrdered(0)) {
+            own.wake.wait(&own.lock);
+        }
+        if (own.sleeping) {
+            own.sleeping = false;
+            _sleeping.fetchAndAddOrdered(-1);
+        }
+    }
+}
+
+
+void WorkPool::finished()
+{
+    if (_outstanding.fetchAndAddOrdered(-1) == 1) {
+        QMutexLocker locker(&_idle_lock);
+        _drained.wakeAll();
+    }
+}
+
+
+WorkThread::WorkThread(WorkPool *pool, int index)
+{
+    _pool = pool;
+    _index = index;
+}
+
+
+void WorkThread::run()
+{
+    for (;;) {
+        WorkItem *item = _pool->take(_index);
+        if (item == NULL) {
+            return;
+        }
+
+        item->run_work();
+        _pool->finished();
+    }
+}
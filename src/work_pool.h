@@ -0,0 +1,135 @@
+// FireNode
+// Copyright (c) 2013 Jon Evans
+// http://craftyjon.com/projects/openlights/firenode
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+
+#ifndef _WORK_POOL_H
+#define _WORK_POOL_H
+
+#include "portability.h"
+#include "realtime.h"
+
+#include <cstddef>
+
+#include <QtCore/QThread>
+#include <QtCore/QMutex>
+#include <QtCore/QWaitCondition>
+#include <QtCore/QAtomicInt>
+
+
+#define WORK_POOL_MAX_THREADS 64
+// Items each worker's queue holds; one per output is enough
+#define WORK_POOL_QUEUE_SIZE 256
+
+// Objects touched by different threads start on a line of their own
+#define CACHE_LINE_SIZE 64
+
+
+//! Something a WorkPool runs.  The same item may be submitted again once it
+//! has started running.
+class WorkItem
+{
+public:
+    virtual ~WorkItem() {}
+    virtual void run_work(void) = 0;
+};
+
+
+class WorkThread;
+
+
+//! A thread per core, each with its own queue of items.
+//!
+//! Submitted items are dealt out to the queues in turn.  A worker runs the
+//! oldest item in its own queue, and once that is empty steals the newest
+//! from another worker's before going to sleep, so one slow item never holds
+//! up the ones queued behind it.
+class WorkPool
+{
+public:
+    //! threads 0 for one per core.  Every thread applies policy, if given, as it starts.
+    WorkPool(int threads = 0, RealtimePolicy *policy = NULL);
+    ~WorkPool();
+
+    int threads(void) const { return _count; }
+    //! False if any thread could not be created.  Its queue is never run.
+    bool started(void) const { return _started; }
+
+    //! False if every queue is full.  The item is not queued, so the caller
+    //! should run it itself once it holds no locks the item needs.
+    bool submit(WorkItem *item);
+    //! Blocks until every item submitted so far has finished.
+    void wait_idle(void);
+
+private:
+    friend class WorkThread;
+
+    //! A worker's queue, alone on its cache lines
+    struct Q_DECL_ALIGN(CACHE_LINE_SIZE) Queue
+    {
+        QMutex lock;
+        //! Woken when the owner is sleeping and work turns up anywhere
+        QWaitCondition wake;
+        bool sleeping;
+        WorkItem *items[WORK_POOL_QUEUE_SIZE];
+        int head;
+        int count;
+    };
+
+    //! Next item for worker, or NULL once the pool shuts down.
+    WorkItem *take(int worker);
+    void finished(void);
+    //! Wakes one sleeping worker, trying the owner of queue first.
+    void wake_worker(int queue);
+
+    int _count;
+    Queue *_queues;
+    WorkThread *_threads[WORK_POOL_MAX_THREADS];
+    QAtomicInt _next;
+
+    // Items sitting in any queue, and workers asleep waiting for one
+    QAtomicInt _queued;
+    QAtomicInt _sleeping;
+    // Only wait_idle() and the last item to finish take this
+    QMutex _idle_lock;
+    QWaitCondition _drained;
+    QAtomicInt _outstanding;
+    QAtomicInt _exit;
+    bool _started;
+};
+
+
+class WorkThread : public QThread
+{
+    Q_OBJECT
+
+public:
+    WorkThread(WorkPool *pool, int index);
+
+protected:
+    void run(void);
+
+private:
+    WorkPool *_pool;
+    int _index;
+};
+
+#endif
@@ -0,0 +1,166 @@
+// FireNode
+// Copyright (c) 2013 Jon Evans
+// http://craftyjon.com/projects/openlights/firenode
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+
+
+
+// Round-trips buffers through both run-length encoders and the host-side
+// decoder: random and run-heavy content, odd lengths, runs longer than
+// RLE_MAX_RUN, and output buffers one byte too small.
+//
+//   cd tests && qmake rle_roundtrip.pro && make && ./rle_roundtrip
+
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include "portability.h"
+#include "rle.h"
+
+#define TEST_RANDOM_BUFFERS 2000
+#define TEST_MAX_LENGTH 5000
+
+
+static int failures = 0;
+
+static void check(bool ok, const char *what, size_t len)
+{
+    if (!ok) {
+        fprintf(stderr, "FAIL: %s (%d bytes)\n", what, (int)len);
+        failures++;
+    }
+}
+
+
+//! Deterministic, so a failure reproduces.
+static uint32_t next_random(void)
+{
+    static uint32_t state = 0x12345678;
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+}
+
+
+static std::vector<uint8_t> random_bytes(size_t len)
+{
+    std::vector<uint8_t> buffer(len);
+    for (size_t i = 0; i < len; i++) {
+        buffer[i] = (uint8_t)next_random();
+    }
+    return buffer;
+}
+
+
+//! Runs of 1 to 3 * RLE_MAX_RUN bytes, mostly 0x00 and 0xFF like dark bit planes.
+static std::vector<uint8_t> run_heavy_bytes(size_t len)
+{
+    std::vector<uint8_t> buffer(len);
+    size_t i = 0;
+
+    while (i < len) {
+        size_t run = 1 + next_random() % (3 * RLE_MAX_RUN);
+        uint32_t pick = next_random() % 4;
+        uint8_t value = (pick == 0) ? 0x00 : (pick == 1) ? 0xFF : (uint8_t)next_random();
+
+        for (size_t j = 0; j < run && i < len; j++) {
+            buffer[i++] = value;
+        }
+    }
+    return buffer;
+}
+
+
+static void round_trip(const std::vector<uint8_t> &input)
+{
+    size_t len = input.size();
+    const uint8_t *in = len ? &input[0] : NULL;
+    size_t capacity = RLE_MAX_ENCODED(len);
+
+    std::vector<uint8_t> simd(capacity + 1), scalar(capacity + 1), decoded(len + 1);
+
+    size_t simd_size = rle_encode(in, len, &simd[0], capacity);
+    size_t scalar_size = rle_encode_scalar(in, len, &scalar[0], capacity);
+
+    if (len == 0) {
+        check(simd_size == 0 && scalar_size == 0, "empty input encoded to something", len);
+        return;
+    }
+
+    check(simd_size > 0 && simd_size <= capacity, "encoder did not fit in RLE_MAX_ENCODED", len);
+    check(simd_size == scalar_size && memcmp(&simd[0], &scalar[0], simd_size) == 0,
+          "SSE2 and scalar encoders disagree", len);
+
+    size_t decoded_size = rle_decode(&simd[0], simd_size, &decoded[0], len);
+    check(decoded_size == len && memcmp(&decoded[0], in, len) == 0, "decoded bytes differ from input", len);
+
+    // One byte short, everywhere
+    check(rle_encode(in, len, &simd[0], simd_size - 1) == 0, "encoder overflowed a short buffer", len);
+    check(rle_encode_scalar(in, len, &scalar[0], simd_size - 1) == 0,
+          "scalar encoder overflowed a short buffer", len);
+
+    simd_size = rle_encode(in, len, &simd[0], capacity);
+    check(rle_decode(&simd[0], simd_size, &decoded[0], len - 1) == 0, "decoder overflowed a short buffer", len);
+    check(rle_decode(&simd[0], simd_size - 1, &decoded[0], len) == 0, "decoder accepted a truncated stream", len);
+}
+
+
+int main(int argc, char *argv[])
+{
+    (void)argc;
+    (void)argv;
+
+    // Around the 16-byte SSE2 blocks and the literal and run limits
+    static const size_t edges[] = {0, 1, 2, 3, 4, 15, 16, 17, 18, 19, 33,
+                                   RLE_MAX_LITERAL - 1, RLE_MAX_LITERAL, RLE_MAX_LITERAL + 1,
+                                   RLE_MAX_RUN - 1, RLE_MAX_RUN, RLE_MAX_RUN + 1, RLE_MAX_RUN + 2,
+                                   2 * RLE_MAX_RUN + 1, 1001};
+    int buffers = 0;
+
+    for (size_t i = 0; i < sizeof(edges) / sizeof(edges[0]); i++) {
+        size_t len = edges[i];
+        round_trip(random_bytes(len));
+        round_trip(run_heavy_bytes(len));
+        round_trip(std::vector<uint8_t>(len, 0x00));
+        round_trip(std::vector<uint8_t>(len, 0xA5));
+        buffers += 4;
+    }
+
+    for (int i = 0; i < TEST_RANDOM_BUFFERS; i++) {
+        size_t len = next_random() % TEST_MAX_LENGTH;
+        round_trip((i & 1) ? random_bytes(len) : run_heavy_bytes(len));
+        buffers++;
+    }
+
+    // A run several times RLE_MAX_RUN splits into full runs and a short tail
+    std::vector<uint8_t> zeros(3 * RLE_MAX_RUN + 1, 0x00);
+    std::vector<uint8_t> out(RLE_MAX_ENCODED(zeros.size()));
+    size_t size = rle_encode(&zeros[0], zeros.size(), &out[0], out.size());
+    check(size == 3 * 2 + 2, "long run not split into RLE_MAX_RUN pieces", zeros.size());
+    check(out[0] == 128 + RLE_MAX_RUN - RLE_MIN_RUN && out[1] == 0x00, "first piece is not a full run",
+          zeros.size());
+
+    printf("%d buffers round-tripped: %s\n", buffers, failures == 0 ? "ok" : "FAILED");
+
+    return failures == 0 ? 0 : 1;
+}
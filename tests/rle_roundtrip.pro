@@ -0,0 +1,11 @@
+TEMPLATE = app
+CONFIG += console
+CONFIG -= qt
+TARGET = rle_roundtrip
+
+INCLUDEPATH += ../src
+
+SOURCES +=  rle_roundtrip.cpp \
+            ../src/rle.cpp
+
+HEADERS +=  ../src/rle.h
@@ -0,0 +1,249 @@
+// FireNode
+// Copyright (c) 2013 Jon Evans
+// http://craftyjon.com/projects/openlights/firenode
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+
+
+// Drives USBStrandController through an in-process transport and checks what
+// reaches the bus: chunk sizes, the last flag and byte order, with all
+// USB_TRANSFERS transfers in flight at once.
+//
+//   cd tests && qmake usb_loopback.pro && make && ./usb_loopback
+
+#include <cstdio>
+#include <vector>
+
+#include <QtCore/QCoreApplication>
+#include <QtCore/QByteArray>
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QMutex>
+#include <QtCore/QWaitCondition>
+#include <QtCore/QQueue>
+
+#include "usb.h"
+
+#define TEST_TIMEOUT_MS 5000
+
+
+//! One transfer as it was submitted.
+struct Chunk
+{
+    QByteArray data;
+    bool last;
+};
+
+
+//! Like LoopbackTransport, but records every transfer and holds completions
+//! back until the controller has filled all of its transfers or ended a frame.
+class RecordingTransport : public UsbTransport
+{
+public:
+    RecordingTransport() : _in_flight(0), _max_in_flight(0), _frames(0), _overwritten(0) {}
+
+    bool open(void) { return true; }
+    void close(void) {}
+
+    bool submit(UsbTransfer *transfer)
+    {
+        QMutexLocker locker(&_lock);
+
+        Chunk chunk;
+        chunk.data = QByteArray(transfer->buffer.constData(), transfer->length);
+        chunk.last = transfer->last;
+        _chunks.push_back(chunk);
+        _pending.push_back(chunk.data);
+
+        _queue.enqueue(transfer);
+        _in_flight++;
+        _max_in_flight = qMax(_max_in_flight, _in_flight);
+        _changed.wakeAll();
+        return true;
+    }
+
+    void handle_events(int timeout_ms)
+    {
+        _lock.lock();
+        if (!ready()) {
+            _changed.wait(&_lock, timeout_ms);
+        }
+
+        while (ready()) {
+            UsbTransfer *transfer = _queue.dequeue();
+            QByteArray submitted = _pending.front();
+            _pending.erase(_pending.begin());
+
+            // The controller must leave a buffer alone while it is on the bus
+            if (QByteArray(transfer->buffer.constData(), transfer->length) != submitted) {
+                _overwritten++;
+            }
+            if (transfer->last) {
+                _frames++;
+            }
+            _in_flight--;
+            transfer->ok = true;
+
+            _lock.unlock();
+            transfer->owner->transfer_complete(transfer);
+            _lock.lock();
+            _changed.wakeAll();
+        }
+        _lock.unlock();
+    }
+
+    //! Waits until frames have gone out in full.
+    bool wait_frames(int frames)
+    {
+        QMutexLocker locker(&_lock);
+        QElapsedTimer timer;
+        timer.start();
+
+        while (_frames < frames) {
+            int left = TEST_TIMEOUT_MS - timer.elapsed();
+            if (left <= 0) {
+                return false;
+            }
+            _changed.wait(&_lock, left);
+        }
+        return true;
+    }
+
+    std::vector<Chunk> chunks(void) { QMutexLocker locker(&_lock); return _chunks; }
+    int max_in_flight(void) { QMutexLocker locker(&_lock); return _max_in_flight; }
+    int overwritten(void) { QMutexLocker locker(&_lock); return _overwritten; }
+
+private:
+    bool ready(void) const
+    {
+        if (_queue.isEmpty()) {
+            return false;
+        }
+        return _queue.size() == USB_TRANSFERS || _queue.back()->last;
+    }
+
+    QMutex _lock;
+    QWaitCondition _changed;
+    QQueue<UsbTransfer *> _queue;
+    std::vector<QByteArray> _pending;
+    std::vector<Chunk> _chunks;
+    int _in_flight;
+    int _max_in_flight;
+    int _frames;
+    int _overwritten;
+};
+
+
+static int failures = 0;
+
+static void check(bool ok, const char *what)
+{
+    if (!ok) {
+        fprintf(stderr, "FAIL: %s\n", what);
+        failures++;
+    }
+}
+
+
+//! Header, payload and trailer filled with a pattern unique to seed.
+static QByteArray make_segment(int length, int seed)
+{
+    QByteArray segment(length, 0);
+    for (int i = 0; i < length; i++) {
+        segment[i] = (char)((i * 7 + seed * 31 + (i >> 8)) & 0xFF);
+    }
+    return segment;
+}
+
+
+static QByteArray send_frame(USBStrandController *controller, int payload, int seed)
+{
+    QByteArray header = make_segment(5, seed);
+    QByteArray data = make_segment(payload, seed + 1);
+    QByteArray trailer = make_segment(3, seed + 2);
+
+    OutputFrame frame;
+    frame.data[FRAME_HEADER] = header.constData();
+    frame.length[FRAME_HEADER] = header.size();
+    frame.data[FRAME_PAYLOAD] = data.constData();
+    frame.length[FRAME_PAYLOAD] = data.size();
+    frame.data[FRAME_TRAILER] = trailer.constData();
+    frame.length[FRAME_TRAILER] = trailer.size();
+
+    controller->update_data(&frame);
+    controller->write_data();
+
+    return header + data + trailer;
+}
+
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+
+    RecordingTransport *transport = new RecordingTransport();
+    USBStrandController *controller = new USBStrandController(transport);
+    controller->set_pipeline_depth(2, 0);
+
+    // More than USB_TRANSFERS chunks, so transfers get reused mid-frame, then
+    // one that ends partway through a chunk
+    QByteArray expected = send_frame(controller, USB_TRANSFERS * USB_CHUNK_SIZE + 1000, 1);
+    check(transport->wait_frames(1), "first frame did not finish");
+    int first_size = expected.size();
+
+    expected += send_frame(controller, USB_CHUNK_SIZE + 17, 2);
+    check(transport->wait_frames(2), "second frame did not finish");
+
+    std::vector<Chunk> chunks = transport->chunks();
+    int max_in_flight = transport->max_in_flight();
+    int overwritten = transport->overwritten();
+    delete controller;
+
+    QByteArray received;
+    int frame_start = 0;
+    int lasts = 0;
+
+    for (size_t i = 0; i < chunks.size(); i++) {
+        const Chunk &chunk = chunks[i];
+        int frame_size = (lasts == 0) ? first_size : expected.size() - first_size;
+        int offset = received.size() - frame_start;
+
+        check(chunk.data.size() > 0, "empty transfer");
+        check(chunk.data.size() == qMin(USB_CHUNK_SIZE, frame_size - offset),
+              "transfer is not a full chunk, or the rest of the frame");
+        check(chunk.last == (offset + chunk.data.size() == frame_size),
+              "last flag not on exactly the final chunk of a frame");
+
+        received += chunk.data;
+        if (chunk.last) {
+            lasts++;
+            frame_start = received.size();
+        }
+    }
+
+    check(lasts == 2, "expected two frames");
+    check(received == expected, "bytes reached the bus out of order");
+    check(max_in_flight == USB_TRANSFERS, "transfers were not all in flight together");
+    check(overwritten == 0, "a transfer buffer changed while in flight");
+
+    printf("%d chunks, %d bytes, up to %d in flight: %s\n", (int)chunks.size(), received.size(),
+           max_in_flight, failures == 0 ? "ok" : "FAILED");
+
+    return failures == 0 ? 0 : 1;
+}
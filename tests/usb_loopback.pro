@@ -0,0 +1,26 @@
+TEMPLATE = app
+CONFIG += qt console
+TARGET = usb_loopback
+QT += core
+QT -= gui
+
+INCLUDEPATH += ../src
+
+SOURCES +=  usb_loopback.cpp \
+            ../src/usb.cpp \
+            ../src/output.cpp \
+            ../src/protocol.cpp \
+            ../src/frame.cpp \
+            ../src/pipeline.cpp \
+            ../src/strand_store.cpp \
+            ../src/alloc_tracker.cpp \
+            ../src/realtime.cpp
+
+HEADERS +=  ../src/usb.h \
+            ../src/output.h \
+            ../src/protocol.h \
+            ../src/frame.h \
+            ../src/pipeline.h \
+            ../src/strand_store.h \
+            ../src/alloc_tracker.h \
+            ../src/realtime.h